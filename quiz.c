@@ -1,7 +1,7 @@
-// TODO: support for utf-8 (brazilian accents)?
 // TODO: try cross-platform compilation
 
 #include <stdio.h>
+#include <ctype.h>
 #include <time.h>
 #include <limits.h>
 #include <stdint.h>
@@ -14,15 +14,31 @@
        
 #include "raylib.h"
 #include "raymath.h"
+#include "rlgl.h"
 
 #if defined(PLATFORM_WEB)
     #include <emscripten/emscripten.h>
+#else
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <signal.h>
+    #include <unistd.h>
+    #include <pthread.h>
+    #include <sys/epoll.h>
+    #include <sys/resource.h>
+    #include <sys/stat.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
 #endif
 
-#if defined(PLATFORM_DESKTOP)
-   #define GLSL_VERSION 330
-#else 
+// nothing defines PLATFORM_DESKTOP for the local build, only the web build defines its platform
+#if defined(PLATFORM_WEB)
    #define GLSL_VERSION 100
+#else
+   #define GLSL_VERSION 330
 #endif
                     
 #define DEBUG_SAVE_MAP_TO_PNG    
@@ -34,6 +50,7 @@
 #define MAX_CAMERA_ZOOM 3.0f
 
 #define HUD_LIFETIME 0.7 
+#define HUD_MAX_FRAME_TIME (1.0f/30.0f)
 #define HUD_DEFAULT_FONTSIZE 50
 #define HUD_LARGE_FONTSIZE 90 
 #define DEFAULT_IMAGE_SCALE 0.5
@@ -56,6 +73,10 @@
 #define COLOR_GUESSED_WERRORS_PROVINCE   GetColor(0xFFF370FF)
 #define COLOR_INCORRECT_PROVINCE         GetColor(0xB52A2AFF) 
 #define COLOR_LEARN_PROVINCE             COLOR_GUESSED_PERFECT_PROVINCE 
+#define COLOR_PROVINCE_NAMES             GetColor(0x303030FF)
+#define COLOR_OUTLINE                    GetColor(0xF0F0F0FF)
+#define COLOR_MESH_LAND                  BLACK
+#define COLOR_HOVERED_PROVINCE           GetColor(0xF2AF2966)
 #define COLOR_VICTORY                    ColorBrightness(GetColor(0x7DD181FF), -0.3)
 
 // -------------------------------------------------------------------------------------------
@@ -96,48 +117,47 @@
     } while (0)
 // -------------------------------------------------------------------------------------------
 
-typedef struct {
-    unsigned long key;
-    char* value;
-    Vector2 center;
-    bool guessed;
-} Province;
-    
-Province *PROVINCES = NULL;
-Province *hidden_province = NULL;
-
-bool any_provinces_left_to_guess()
+double now_seconds()
 {
-    bool any_not_guessed = false;
-    Province *p;
-
-    for (int i = 0; i < hmlen(PROVINCES); ++i) {
-        p = &PROVINCES[i];
-        if (!p->guessed) any_not_guessed = true;
-    }
-
-    return any_not_guessed;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
 }
 
-Province* select_random_province()
+uint64_t fnv1a(const void *data, size_t size, uint64_t hash)
 {
-    bool found = false;
-    Province *p;
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
 
-    while (!found) {
-        int i = rand() % hmlen(PROVINCES);
-        p = &PROVINCES[i];
-        found = !p->guessed;
-    } 
+// Whatever takes long to compute at the startup is kept here, keyed by the hashes of its inputs
+#define CACHE_DIR "cache"
 
-    return p;
+#if !defined(PLATFORM_WEB)
+bool cache_dir_create()
+{
+    if (!DirectoryExists(CACHE_DIR) && (mkdir(CACHE_DIR, 0755) < 0)) {
+        fprintf(stderr, "WARNING: could not create %s: %s\n", CACHE_DIR, strerror(errno));
+        return false;
+    }
+    return true;
 }
+#endif // PLATFORM_WEB
+
+typedef struct {
+    unsigned long key;
+    char* value;
+} Province;
 
 typedef enum {
     QUIZ = 0,
     VICTORY,
     LEARN,
-} GameState; 
+} GameState;
 
 typedef enum {
     MAP_MEXICO = 0,
@@ -149,12 +169,97 @@ typedef enum {
 
 Font font = {0};
 Shader shader = {0};
-Texture2D map_texture = {0};
-Camera2D camera = {0};
-GameState state = QUIZ;
-ActiveMap active_map = MAP_MEXICO; // counter in the COUNTRIES array 
-RenderTexture2D canvas = {0};
 
+// Draws the map with the marked provinces colored and the hovered one highlighted, see resources/shaders/glsl330/map.fs
+typedef struct {
+    Shader shader;
+    int labels_loc;
+    int palette_loc;
+    int province_count_loc;
+    int hovered_loc;
+    int highlight_loc;
+} MapShader;
+
+MapShader map_shader = {0};
+
+// Draws the provinces of the mesh, see resources/shaders/glsl330/mesh.fs; the palette goes as the diffuse map
+typedef struct {
+    Shader shader;
+    int province_count_loc;
+    int hovered_loc;
+    int highlight_loc;
+    int land_loc;
+} MeshShader;
+
+MeshShader mesh_shader = {0};
+RenderTexture2D canvas = {0}; // allocated on demand, the frames are drawn straight to the screen
+
+// Inclusive pixel bounds of a province in the maps
+typedef struct {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} ProvinceBox;
+
+// A connected piece of a province
+typedef struct {
+    int area;         // in pixels
+    ProvinceBox box;
+    Vector2 centroid; // in the image coordinates
+} ProvinceComponent;
+
+/*
+ * The province adjacency graph in the compressed sparse row layout: the neighbors of
+ * the province `i` are `neighbors[offsets[i]]` up to `neighbors[offsets[i + 1]]`, sorted.
+ */
+typedef struct {
+    int *offsets;        // province_count + 1
+    uint16_t *neighbors; // province indices, every pair is there both ways
+} Adjacency;
+
+#define OUTLINE_LEVELS 4
+
+// A closed ring of the outline of a province, `count` points from `start` of its level
+typedef struct {
+    int32_t province;
+    int32_t start;
+    int32_t count;
+} OutlineRing;
+
+typedef struct {
+    OutlineRing *rings; // stb_ds array, in the order of the provinces
+    Vector2 *points;    // stb_ds array, in the image coordinates
+} OutlineLevel;
+
+// The province borders as polygons simplified at the tolerances of `OUTLINE_TOLERANCES`, see `load_country_outlines`
+typedef struct {
+    OutlineLevel levels[OUTLINE_LEVELS];
+} Outlines;
+
+// The triangles touching a cell `i` are `triangles[offsets[i]]` up to `triangles[offsets[i + 1]]`, see `index_province_mesh`
+typedef struct {
+    int columns;
+    int rows;
+    int *offsets;   // columns*rows + 1
+    int *triangles;
+} TriangleGrid;
+
+// The provinces cut into triangles, see `triangulate_country`
+typedef struct {
+    Vector2 *vertices;   // stb_ds array, in the image coordinates
+    uint16_t *provinces; // stb_ds array, the province of every vertex
+    uint16_t *indices;   // stb_ds array, three per triangle
+    int level;           // of the outlines it is made of
+    TriangleGrid grid;
+} ProvinceMesh;
+
+/*
+ * Immutable data of a country shared by all the sessions: the label map,
+ * the pristine black-white map and the table mapping label colors to the provinces.
+ * It is loaded once at startup and must not be modified afterwards, except that the window
+ * drops the label map and the labels with `--gpu-picking` before any session starts.
+ */
 typedef struct {
     char *name;
     char *display_name;
@@ -163,9 +268,24 @@ typedef struct {
     Image color_map;
 
     char* bw_map_filename;
-    Image bw_map; 
+    Image bw_map;
+
+    Province *provinces; // hashmap: label color -> province name
+    ProvinceBox *boxes;  // bounding box of every province, in the order of `provinces`
+    uint16_t *labels;    // province index + 1 of every pixel of the maps, 0 if there is none, see `snap_province_labels`
+    Adjacency adjacency; // see `fill_province_adjacency`
+
+    ProvinceComponent *components; // stb_ds array: the pieces of all the provinces, see `fill_province_components`
+    int *component_offsets;        // province_count + 1, the components of a province are a slice like in `Adjacency`
+    Vector2 *anchors;              // stb_ds array: where the name of every province goes, see `fill_province_anchors`
+    Outlines outlines;             // only in the window, see `load_country_outlines`
+    ProvinceMesh mesh;             // only with `--mesh`
+    int snap_radius;               // see `snap_province_labels`
+    char *province_table;          // of an imported country, the names of `provinces` point into it
 } Country;
 
+#define LABEL_SNAPPED 0x8000 // the pixel is not in the province, only near it
+
 typedef struct {
     Country *items;
     size_t count;
@@ -174,24 +294,32 @@ typedef struct {
 
 Countries COUNTRIES = {0};
 
-Country* load_country(const char* country_name, const char* display_name)
+void fill_provinces(Country *country, int country_counter);
+void fill_province_labels(Country *country);
+void fill_province_adjacency(Country *country);
+void fill_province_components(Country *country);
+void fill_province_anchors(Country *country);
+void snap_province_labels(Country *country, int radius);
+int mesh_province_at(const Country *country, Vector2 point);
+
+Country* load_country(const char* country_name, const char* display_name, int snap_radius)
 {
     // TODO: implement arena allocator to hold all these random strings
     //       instead of malloc-ing
     Country country_item = {0};
-   
+
     country_item.name = malloc(TextLength(country_name) + 1);
     TextCopy(country_item.name, country_name);
 
     country_item.display_name = malloc(TextLength(display_name) + 1);
-    TextCopy(country_item.display_name, display_name); 
+    TextCopy(country_item.display_name, display_name);
 
-    const char *tmp;    
+    const char *tmp;
     tmp = TextFormat("resources/%s-colored.png", TextToLower(country_item.name));
     country_item.color_map_filename = malloc(TextLength(tmp) + 1);
     TextCopy(country_item.color_map_filename, tmp);
 
-    tmp = TextFormat("resources/%s-black-white.png", TextToLower(country_item.name)); 
+    tmp = TextFormat("resources/%s-black-white.png", TextToLower(country_item.name));
     country_item.bw_map_filename = malloc(TextLength(tmp) + 1);
     TextCopy(country_item.bw_map_filename, tmp);
 
@@ -201,181 +329,286 @@ Country* load_country(const char* country_name, const char* display_name)
 
     assert((country_item.color_map.width   == country_item.bw_map.width) &&
             (country_item.color_map.height == country_item.bw_map.height));
+
+    // countries are loaded in the order of `ActiveMap`
+    fill_provinces(&country_item, COUNTRIES.count);
+    fill_province_labels(&country_item);
+    fill_province_adjacency(&country_item);
+    fill_province_components(&country_item);
+    fill_province_anchors(&country_item);
+    snap_province_labels(&country_item, snap_radius);
+    country_item.snap_radius = snap_radius;
     da_append(&COUNTRIES, country_item);
 
     return &COUNTRIES.items[COUNTRIES.count - 1];
 }
 
-Country* reload_country(size_t i)
+void unload_country(Country *c)
+{
+    UnloadImage(c->bw_map);
+    UnloadImage(c->color_map);
+    hmfree(c->provinces);
+    arrfree(c->boxes);
+    free(c->labels);
+    free(c->adjacency.offsets);
+    free(c->adjacency.neighbors);
+    arrfree(c->components);
+    free(c->component_offsets);
+    arrfree(c->anchors);
+    for (int l = 0; l < OUTLINE_LEVELS; ++l) {
+        arrfree(c->outlines.levels[l].rings);
+        arrfree(c->outlines.levels[l].points);
+    }
+    arrfree(c->mesh.vertices);
+    arrfree(c->mesh.provinces);
+    arrfree(c->mesh.indices);
+    free(c->mesh.grid.offsets);
+    free(c->mesh.grid.triangles);
+    free(c->name);
+    free(c->display_name);
+    free(c->color_map_filename);
+    free(c->bw_map_filename);
+    if (c->province_table != NULL) UnloadFileText(c->province_table);
+}
+
+// The table of an imported country, see `import_country`: a line per province with the hex color of the colored map and the name
+bool load_province_table(Country *country)
+{
+    const char *path = TextFormat("resources/%s-provinces.txt", TextToLower(country->name));
+    if (!FileExists(path)) return false;
+
+    char *table = LoadFileText(path);
+    if (table == NULL) return false;
+
+    Province *provinces = NULL;
+    for (char *line = table; *line != '\0';) {
+        char *end = strchr(line, '\n');
+        if (end != NULL) *end = '\0';
+
+        char *name = strchr(line, '\t');
+        if (name != NULL) {
+            unsigned long rgb = strtoul(line, NULL, 16);
+            hmput(provinces, (rgb << 8) | 0xff, name + 1);
+        }
+
+        if (end == NULL) break;
+        line = end + 1;
+    }
+
+    printf("Loaded %d provinces of %s from %s\n", (int) hmlen(provinces), country->name, path);
+    country->provinces = provinces;
+    country->province_table = table;
+    return true;
+}
+
+int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(const char**) a, *(const char**) b);
+}
+
+// The countries of `import_country` next to the bundled ones, which `main` loads first, in the order of their names
+void load_imported_countries(int snap_radius)
 {
-    assert(i < COUNTRIES.count);
+    static const char *suffix = "-provinces.txt";
+
+    FilePathList files = LoadDirectoryFilesEx("resources", ".txt", false);
+    qsort(files.paths, files.count, sizeof(char*), compare_strings);
+
+    for (unsigned int i = 0; i < files.count; ++i) {
+        const char *file = GetFileName(files.paths[i]);
+        int length = TextLength(file) - TextLength(suffix);
+        if ((length <= 0) || !TextIsEqual(file + length, suffix)) continue;
+
+        char name[256] = {0};
+        if (length >= (int) sizeof(name)) continue;
+        memcpy(name, file, length);
+
+        // a bundled country takes the table in `fill_provinces`
+        bool bundled = false;
+        for (size_t k = 0; k < COUNTRIES.count; ++k) {
+            if (TextIsEqual(TextToLower(COUNTRIES.items[k].name), name)) bundled = true;
+        }
+        if (bundled) continue;
+
+        if (!FileExists(TextFormat("resources/%s-colored.png", name)) ||
+            !FileExists(TextFormat("resources/%s-black-white.png", name))) {
+            fprintf(stderr, "WARNING: the maps of %s are missing next to its province table\n", name);
+            continue;
+        }
 
-    Country* c = &COUNTRIES.items[i];
-    c->bw_map = LoadImage(c->bw_map_filename);
-    ImageFormat(&c->bw_map, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        // the display name is the file name, capitalized, with its dashes as line breaks
+        char display_name[256];
+        memcpy(display_name, name, length + 1);
+        for (int k = 0; k < length; ++k) {
+            if (display_name[k] == '-') display_name[k] = '\n';
+            if ((k == 0) || (display_name[k - 1] == '\n')) display_name[k] = toupper((unsigned char) display_name[k]);
+        }
+        load_country(name, display_name, snap_radius);
+    }
 
-    return c;
+    UnloadDirectoryFiles(files);
 }
 
-void fill_provinces(int country_counter) {
-    hmfree(PROVINCES);
+void fill_provinces(Country *country, int country_counter) {
+    Province *provinces = NULL;
+    if (load_province_table(country)) return;
 
     switch (country_counter) {
         case MAP_MEXICO: {
-            hmput(PROVINCES, 0x00ffffff, "Baja California");
-            hmput(PROVINCES, 0x808080ff, "Baja California Sur"); 
-            hmput(PROVINCES, 0x800000ff, "Sonora");
-            hmput(PROVINCES, 0x808000ff, "Chihuahua");
-            hmput(PROVINCES, 0x008000ff, "Coahuila");
-            hmput(PROVINCES, 0x000080ff, "Nuevo Leon");
-            hmput(PROVINCES, 0xff00ffff, "Tamaulipas");
-            hmput(PROVINCES, 0xff0000ff, "Sinaloa");
-            hmput(PROVINCES, 0xffff00ff, "Durango");
-            hmput(PROVINCES, 0x00ff00ff, "Zacatecas");
-            hmput(PROVINCES, 0x0000ffff, "San Luis Potosi");
-            hmput(PROVINCES, 0x6bd4bfff, "Veracruz");
-            hmput(PROVINCES, 0x008080ff, "Nayarit");
-            hmput(PROVINCES, 0xe94f37ff, "Jalisco");
-            hmput(PROVINCES, 0x004040ff, "Colima");
-            hmput(PROVINCES, 0x808040ff, "Michoacan");
-            hmput(PROVINCES, 0x80ffffff, "Guerrero");
-            hmput(PROVINCES, 0xb04f89ff, "Oaxaca"); 
-            hmput(PROVINCES, 0x2d534eff, "Chiapas"); 
-            hmput(PROVINCES, 0x9a83bcff, "Tabasco"); 
-            hmput(PROVINCES, 0x804000ff, "Puebla"); 
-            hmput(PROVINCES, 0xb18e93ff, "Campeche"); 
-            hmput(PROVINCES, 0xd2beadff, "Yucatan"); 
-            hmput(PROVINCES, 0xf4948bff, "Quintana Roo"); 
-            hmput(PROVINCES, 0xff0080ff, "Mexico City"); 
-            hmput(PROVINCES, 0xffff80ff, "Aguascalientes"); 
-            hmput(PROVINCES, 0x800080ff, "Guanajuato"); 
-            hmput(PROVINCES, 0x0080ffff, "Queretaro"); 
-            hmput(PROVINCES, 0x004080ff, "Hidalgo"); 
-            hmput(PROVINCES, 0x00ff80ff, "State of Mexico"); 
-            hmput(PROVINCES, 0x4000ffff, "Morelos"); 
-            hmput(PROVINCES, 0xff8040ff, "Tlaxcala"); 
-            assert(hmlen(PROVINCES) == 32);
+            hmput(provinces, 0x00ffffff, "Baja California");
+            hmput(provinces, 0x808080ff, "Baja California Sur"); 
+            hmput(provinces, 0x800000ff, "Sonora");
+            hmput(provinces, 0x808000ff, "Chihuahua");
+            hmput(provinces, 0x008000ff, "Coahuila");
+            hmput(provinces, 0x000080ff, "Nuevo León");
+            hmput(provinces, 0xff00ffff, "Tamaulipas");
+            hmput(provinces, 0xff0000ff, "Sinaloa");
+            hmput(provinces, 0xffff00ff, "Durango");
+            hmput(provinces, 0x00ff00ff, "Zacatecas");
+            hmput(provinces, 0x0000ffff, "San Luis Potosí");
+            hmput(provinces, 0x6bd4bfff, "Veracruz");
+            hmput(provinces, 0x008080ff, "Nayarit");
+            hmput(provinces, 0xe94f37ff, "Jalisco");
+            hmput(provinces, 0x004040ff, "Colima");
+            hmput(provinces, 0x808040ff, "Michoacán");
+            hmput(provinces, 0x80ffffff, "Guerrero");
+            hmput(provinces, 0xb04f89ff, "Oaxaca"); 
+            hmput(provinces, 0x2d534eff, "Chiapas"); 
+            hmput(provinces, 0x9a83bcff, "Tabasco"); 
+            hmput(provinces, 0x804000ff, "Puebla"); 
+            hmput(provinces, 0xb18e93ff, "Campeche"); 
+            hmput(provinces, 0xd2beadff, "Yucatán"); 
+            hmput(provinces, 0xf4948bff, "Quintana Roo"); 
+            hmput(provinces, 0xff0080ff, "Mexico City"); 
+            hmput(provinces, 0xffff80ff, "Aguascalientes"); 
+            hmput(provinces, 0x800080ff, "Guanajuato"); 
+            hmput(provinces, 0x0080ffff, "Querétaro"); 
+            hmput(provinces, 0x004080ff, "Hidalgo"); 
+            hmput(provinces, 0x00ff80ff, "State of Mexico"); 
+            hmput(provinces, 0x4000ffff, "Morelos"); 
+            hmput(provinces, 0xff8040ff, "Tlaxcala"); 
+            assert(hmlen(provinces) == 32);
             break;
         };
 
         case MAP_BRAZIL: {
-            hmput(PROVINCES, 0x808080ff, "Acre");
-            hmput(PROVINCES, 0x008000ff, "Rondonia");
-            hmput(PROVINCES, 0x800000ff, "Amazonas");
-            hmput(PROVINCES, 0xff0000ff, "Roraima");
-            hmput(PROVINCES, 0x808000ff, "Para");
-            hmput(PROVINCES, 0xffff00ff, "Amapa");
-            hmput(PROVINCES, 0x00ff00ff, "Mato Grosso");
-            hmput(PROVINCES, 0xff8040ff, "Mato Grosso Do Sul");
-            hmput(PROVINCES, 0x00ffffff, "Maranhao");
-            hmput(PROVINCES, 0x008080ff, "Tocantins");
-            hmput(PROVINCES, 0x000080ff, "Goias");
-            hmput(PROVINCES, 0x800080ff, "Piaui");
-            hmput(PROVINCES, 0xff00ffff, "Ceara");
-            hmput(PROVINCES, 0x808040ff, "Rio Grande do Norte");
-            hmput(PROVINCES, 0xffff80ff, "Paraiba");
-            hmput(PROVINCES, 0x004040ff, "Pernambuco");
-            hmput(PROVINCES, 0x80ffffff, "Alagoas");
-            hmput(PROVINCES, 0x004080ff, "Sergipe");
-            hmput(PROVINCES, 0x8080ffff, "Bahia");
-            hmput(PROVINCES, 0x4000ffff, "Minas Gerais");
-            hmput(PROVINCES, 0x00272bff, "Espirito Santo");
-            hmput(PROVINCES, 0xff665bff, "Rio de Janeiro");
-            hmput(PROVINCES, 0x804000ff, "Sao Paulo");
-            hmput(PROVINCES, 0xd5c619ff, "Parana");
-            hmput(PROVINCES, 0x192a51ff, "Santa Catarina");
-            hmput(PROVINCES, 0xe3dc95ff, "Rio Grande do Sul");
-            hmput(PROVINCES, 0xff0080ff, "Federal District");
-            assert(hmlen(PROVINCES) == 27);
+            hmput(provinces, 0x808080ff, "Acre");
+            hmput(provinces, 0x008000ff, "Rondônia");
+            hmput(provinces, 0x800000ff, "Amazonas");
+            hmput(provinces, 0xff0000ff, "Roraima");
+            hmput(provinces, 0x808000ff, "Pará");
+            hmput(provinces, 0xffff00ff, "Amapá");
+            hmput(provinces, 0x00ff00ff, "Mato Grosso");
+            hmput(provinces, 0xff8040ff, "Mato Grosso Do Sul");
+            hmput(provinces, 0x00ffffff, "Maranhão");
+            hmput(provinces, 0x008080ff, "Tocantins");
+            hmput(provinces, 0x000080ff, "Goiás");
+            hmput(provinces, 0x800080ff, "Piauí");
+            hmput(provinces, 0xff00ffff, "Ceará");
+            hmput(provinces, 0x808040ff, "Rio Grande do Norte");
+            hmput(provinces, 0xffff80ff, "Paraíba");
+            hmput(provinces, 0x004040ff, "Pernambuco");
+            hmput(provinces, 0x80ffffff, "Alagoas");
+            hmput(provinces, 0x004080ff, "Sergipe");
+            hmput(provinces, 0x8080ffff, "Bahia");
+            hmput(provinces, 0x4000ffff, "Minas Gerais");
+            hmput(provinces, 0x00272bff, "Espírito Santo");
+            hmput(provinces, 0xff665bff, "Rio de Janeiro");
+            hmput(provinces, 0x804000ff, "São Paulo");
+            hmput(provinces, 0xd5c619ff, "Paraná");
+            hmput(provinces, 0x192a51ff, "Santa Catarina");
+            hmput(provinces, 0xe3dc95ff, "Rio Grande do Sul");
+            hmput(provinces, 0xff0080ff, "Federal District");
+            assert(hmlen(provinces) == 27);
             break;
         }
 
         case MAP_JAPAN: {
-            hmput(PROVINCES, 0xed1c24ff, "Hokkaido"); 
-            hmput(PROVINCES, 0xff7f27ff, "Aomori"); 
-            hmput(PROVINCES, 0x22b14cff, "Iwate"); 
-            hmput(PROVINCES, 0xfff200ff, "Akita"); 
-            hmput(PROVINCES, 0xa349a4ff, "Miyagi"); 
-            hmput(PROVINCES, 0x3f48ccff, "Yamagata"); 
-            hmput(PROVINCES, 0x00ff00ff, "Fukushima"); 
-            hmput(PROVINCES, 0xffc90eff, "Ibaraki"); 
-            hmput(PROVINCES, 0xb5e61dff, "Tochigi"); 
-            hmput(PROVINCES, 0x99d9eaff, "Gunma"); 
-            hmput(PROVINCES, 0x8000ffff, "Saitama"); 
-            hmput(PROVINCES, 0xff00ffff, "Chiba");
-            hmput(PROVINCES, 0xff0080ff, "Tokyo"); 
-            hmput(PROVINCES, 0x808000ff, "Kanagawa");
-            hmput(PROVINCES, 0xffaec9ff, "Niigata"); 
-            hmput(PROVINCES, 0xc8bfe7ff, "Toyama");
-            hmput(PROVINCES, 0x312893ff, "Ishikawa"); 
-            hmput(PROVINCES, 0x4ffdfdff, "Fukui");
-            hmput(PROVINCES, 0x4bc6d3ff, "Yamanashi"); 
-            hmput(PROVINCES, 0x7092beff, "Nagano");
-            hmput(PROVINCES, 0xfb717bff, "Gifu"); 
-            hmput(PROVINCES, 0x4f803cff, "Shizuoka");
-            hmput(PROVINCES, 0x9a7deeff, "Aichi"); 
-            hmput(PROVINCES, 0x9ad1a2ff, "Mie"); 
-            hmput(PROVINCES, 0xf0e65bff, "Shiga"); 
-            hmput(PROVINCES, 0x05e437ff, "Kyoto");
-            hmput(PROVINCES, 0xa06849ff, "Osaka"); 
-            hmput(PROVINCES, 0x8dd812ff, "Hyogo");
-            hmput(PROVINCES, 0xc487c5ff, "Nara"); 
-            hmput(PROVINCES, 0xd713d1ff, "Wakayama"); 
-            hmput(PROVINCES, 0xb5d2b3ff, "Tottori"); 
-            hmput(PROVINCES, 0xfafa8bff, "Shimane");
-            hmput(PROVINCES, 0xf7948eff, "Okayama"); 
-            hmput(PROVINCES, 0xdbaab8ff, "Hiroshima");
-            hmput(PROVINCES, 0xd89ee7ff, "Yamaguchi"); 
-            hmput(PROVINCES, 0xdec6a7ff, "Tokushima"); 
-            hmput(PROVINCES, 0x88cefdff, "Kagawa"); 
-            hmput(PROVINCES, 0x97ee9dff, "Ehime");
-            hmput(PROVINCES, 0xadaed8ff, "Kochi"); 
-            hmput(PROVINCES, 0xc4bacbff, "Fukuoka");
-            hmput(PROVINCES, 0x98edc9ff, "Saga"); 
-            hmput(PROVINCES, 0x91fefcff, "Nagasaki"); 
-            hmput(PROVINCES, 0xbf9ee7ff, "Kumamoto"); 
-            hmput(PROVINCES, 0xf88dadff, "Oita");
-            hmput(PROVINCES, 0xabdad1ff, "Miyazaki"); 
-            hmput(PROVINCES, 0xfab88bff, "Kagoshima");
-            hmput(PROVINCES, 0x0000ffff, "Okinawa");
-            assert(hmlen(PROVINCES) == 47);
+            hmput(provinces, 0xed1c24ff, "Hokkaido"); 
+            hmput(provinces, 0xff7f27ff, "Aomori"); 
+            hmput(provinces, 0x22b14cff, "Iwate"); 
+            hmput(provinces, 0xfff200ff, "Akita"); 
+            hmput(provinces, 0xa349a4ff, "Miyagi"); 
+            hmput(provinces, 0x3f48ccff, "Yamagata"); 
+            hmput(provinces, 0x00ff00ff, "Fukushima"); 
+            hmput(provinces, 0xffc90eff, "Ibaraki"); 
+            hmput(provinces, 0xb5e61dff, "Tochigi"); 
+            hmput(provinces, 0x99d9eaff, "Gunma"); 
+            hmput(provinces, 0x8000ffff, "Saitama"); 
+            hmput(provinces, 0xff00ffff, "Chiba");
+            hmput(provinces, 0xff0080ff, "Tokyo"); 
+            hmput(provinces, 0x808000ff, "Kanagawa");
+            hmput(provinces, 0xffaec9ff, "Niigata"); 
+            hmput(provinces, 0xc8bfe7ff, "Toyama");
+            hmput(provinces, 0x312893ff, "Ishikawa"); 
+            hmput(provinces, 0x4ffdfdff, "Fukui");
+            hmput(provinces, 0x4bc6d3ff, "Yamanashi"); 
+            hmput(provinces, 0x7092beff, "Nagano");
+            hmput(provinces, 0xfb717bff, "Gifu"); 
+            hmput(provinces, 0x4f803cff, "Shizuoka");
+            hmput(provinces, 0x9a7deeff, "Aichi"); 
+            hmput(provinces, 0x9ad1a2ff, "Mie"); 
+            hmput(provinces, 0xf0e65bff, "Shiga"); 
+            hmput(provinces, 0x05e437ff, "Kyoto");
+            hmput(provinces, 0xa06849ff, "Osaka"); 
+            hmput(provinces, 0x8dd812ff, "Hyogo");
+            hmput(provinces, 0xc487c5ff, "Nara"); 
+            hmput(provinces, 0xd713d1ff, "Wakayama"); 
+            hmput(provinces, 0xb5d2b3ff, "Tottori"); 
+            hmput(provinces, 0xfafa8bff, "Shimane");
+            hmput(provinces, 0xf7948eff, "Okayama"); 
+            hmput(provinces, 0xdbaab8ff, "Hiroshima");
+            hmput(provinces, 0xd89ee7ff, "Yamaguchi"); 
+            hmput(provinces, 0xdec6a7ff, "Tokushima"); 
+            hmput(provinces, 0x88cefdff, "Kagawa"); 
+            hmput(provinces, 0x97ee9dff, "Ehime");
+            hmput(provinces, 0xadaed8ff, "Kochi"); 
+            hmput(provinces, 0xc4bacbff, "Fukuoka");
+            hmput(provinces, 0x98edc9ff, "Saga"); 
+            hmput(provinces, 0x91fefcff, "Nagasaki"); 
+            hmput(provinces, 0xbf9ee7ff, "Kumamoto"); 
+            hmput(provinces, 0xf88dadff, "Oita");
+            hmput(provinces, 0xabdad1ff, "Miyazaki"); 
+            hmput(provinces, 0xfab88bff, "Kagoshima");
+            hmput(provinces, 0x0000ffff, "Okinawa");
+            assert(hmlen(provinces) == 47);
             break;
         }
 
         case MAP_PHILLIPINES_ISLANDS: {
-            hmput(PROVINCES, 0x0000ffff, "Luzon");
-            hmput(PROVINCES, 0x000080ff, "Mindoro");
-            hmput(PROVINCES, 0x008000ff, "Masbate");
-            hmput(PROVINCES, 0x800000ff, "Samar");
-            hmput(PROVINCES, 0x800080ff, "Panay");
-            hmput(PROVINCES, 0x804000ff, "Palawan");
-            hmput(PROVINCES, 0x00ffffff, "Negros");
-            hmput(PROVINCES, 0xff0000ff, "Cebu");
-            hmput(PROVINCES, 0xffff00ff, "Bohol");
-            hmput(PROVINCES, 0x808000ff, "Leyte");
-            hmput(PROVINCES, 0x008080ff, "Mindanao");
-            assert(hmlen(PROVINCES) == 11);
+            hmput(provinces, 0x0000ffff, "Luzon");
+            hmput(provinces, 0x000080ff, "Mindoro");
+            hmput(provinces, 0x008000ff, "Masbate");
+            hmput(provinces, 0x800000ff, "Samar");
+            hmput(provinces, 0x800080ff, "Panay");
+            hmput(provinces, 0x804000ff, "Palawan");
+            hmput(provinces, 0x00ffffff, "Negros");
+            hmput(provinces, 0xff0000ff, "Cebu");
+            hmput(provinces, 0xffff00ff, "Bohol");
+            hmput(provinces, 0x808000ff, "Leyte");
+            hmput(provinces, 0x008080ff, "Mindanao");
+            assert(hmlen(provinces) == 11);
             break;
         }
 
         case MAP_MALAYSIA: {
-            hmput(PROVINCES, 0x808080ff, "Perlis");
-            hmput(PROVINCES, 0xff0000ff, "Penang");
-            hmput(PROVINCES, 0x800000ff, "Kedah");
-            hmput(PROVINCES, 0x808000ff, "Perak");
-            hmput(PROVINCES, 0xffff00ff, "Kelantan");
-            hmput(PROVINCES, 0x008000ff, "Teregganu");
-            hmput(PROVINCES, 0x00ff00ff, "Pahang");
-            hmput(PROVINCES, 0x008080ff, "Selangor");
-            hmput(PROVINCES, 0x00ffffff, "Negeri Sembilan");
-            hmput(PROVINCES, 0x000080ff, "Malacca");
-            hmput(PROVINCES, 0x0000ffff, "Johor");
-            hmput(PROVINCES, 0x800080ff, "Sarawak");
-            hmput(PROVINCES, 0xff00ffff, "Sabah");
-            hmput(PROVINCES, 0x4000ffff, "Kuala Lumpur");
-            hmput(PROVINCES, 0xff0080ff, "Putrajaya"); 
-            hmput(PROVINCES, 0x804000ff, "Labuan"); 
-            assert(hmlen(PROVINCES) == 16);
+            hmput(provinces, 0x808080ff, "Perlis");
+            hmput(provinces, 0xff0000ff, "Penang");
+            hmput(provinces, 0x800000ff, "Kedah");
+            hmput(provinces, 0x808000ff, "Perak");
+            hmput(provinces, 0xffff00ff, "Kelantan");
+            hmput(provinces, 0x008000ff, "Teregganu");
+            hmput(provinces, 0x00ff00ff, "Pahang");
+            hmput(provinces, 0x008080ff, "Selangor");
+            hmput(provinces, 0x00ffffff, "Negeri Sembilan");
+            hmput(provinces, 0x000080ff, "Malacca");
+            hmput(provinces, 0x0000ffff, "Johor");
+            hmput(provinces, 0x800080ff, "Sarawak");
+            hmput(provinces, 0xff00ffff, "Sabah");
+            hmput(provinces, 0x4000ffff, "Kuala Lumpur");
+            hmput(provinces, 0xff0080ff, "Putrajaya"); 
+            hmput(provinces, 0x804000ff, "Labuan"); 
+            assert(hmlen(provinces) == 16);
             break;
         }
 
@@ -384,791 +617,5558 @@ void fill_provinces(int country_counter) {
         }
     } 
 
-    for (int i = 0; i < hmlen(PROVINCES); ++i) {
-        PROVINCES[i].guessed = false;
-    }
+    country->provinces = provinces;
 }
 
-typedef struct {
-    Vector2 ul; // upper-left 
-    Vector2 lr; // lower-right
-    float width;
-    float height;
-} Rec;
-    
-static size_t error_counter = 0;
+/*
+ * The label raster resolves the province under a pixel in O(1) without decoding the color map.
+ * It also goes to the GPU for the map shader and the GPU picking.
+ */
+void fill_province_labels(Country *country)
+{
+    Province *provinces = country->provinces;
+    int province_count = hmlen(provinces);
+    assert(province_count < LABEL_SNAPPED);
+
+    Image color_map = country->color_map;
+    country->labels = calloc(color_map.width * color_map.height, sizeof(uint16_t));
+    assert(country->labels != NULL && "Buy more RAM lol");
+
+    arrsetlen(country->boxes, province_count);
+    for (int i = 0; i < province_count; ++i) {
+        country->boxes[i] = CLITERAL(ProvinceBox) { INT_MAX, INT_MAX, INT_MIN, INT_MIN };
+    }
+
+    // neighbouring pixels mostly share the color, so the lookup is cached
+    unsigned int last_hex = 0;
+    int last = (int) hmgeti(provinces, last_hex);
+
+    for (int py = 0; py < color_map.height; ++py) {
+        for (int px = 0; px < color_map.width; ++px) {
+            unsigned int hex = ColorToInt(GetImageColor(color_map, px, py));
+            if (hex != last_hex) {
+                last_hex = hex;
+                last = (int) hmgeti(provinces, hex);
+            }
+            if (last == -1) continue;
 
-void reset_provinces() {
-    for (int i = 0; i < hmlen(PROVINCES); ++i) {
-        PROVINCES[i].guessed = false;
+            country->labels[py * color_map.width + px] = last + 1;
+
+            ProvinceBox *box = &country->boxes[last];
+            if (px < box->x0) box->x0 = px;
+            if (py < box->y0) box->y0 = py;
+            if (px > box->x1) box->x1 = px;
+            if (py > box->y1) box->y1 = py;
+        }
     }
 }
 
-Rectangle project_rectangle(Rectangle r_abs)
-{
-    Vector3 ul = CLITERAL(Vector3) { r_abs.x, r_abs.y, 0.0 };
-    Vector3 lr = CLITERAL(Vector3) { r_abs.x + r_abs.width, r_abs.y + r_abs.height, 0.0 };
-    Matrix invMatCamera = MatrixInvert(GetCameraMatrix2D(camera));
-    Vector3 ul_t = Vector3Transform(ul, invMatCamera);
-    Vector3 lr_t = Vector3Transform(lr, invMatCamera);
+/*
+ * Two provinces are neighbors if a row or a column of the label raster goes from one to the other
+ * through at most ADJACENCY_MAX_GAP unlabeled pixels. The borders are 4-7 px wide across the bundled
+ * maps, and longer where the row or the column crosses them at a slant, so a strait narrower than
+ * the gap makes neighbors as well. The color maps have stray antialiased pixels on the borders that
+ * happen to be the color of some province, so the runs shorter than ADJACENCY_MIN_RUN count as gaps.
+ *
+ * The rows and the columns are scanned together in a single pass over the raster, with the runs
+ * of the columns kept per column.
+ */
+#define ADJACENCY_MAX_GAP 8
+#define ADJACENCY_MIN_RUN 3
+
+typedef struct {
+    int label;      // of the current run, 0 for a gap
+    int start;
+    int length;
+    int last_label; // of the last run that is long enough, 0 if none
+    int last_end;
+} LabelRun;
+
+typedef struct {
+    int n;
+    uint8_t *pairs; // n x n bit matrix, there are only tens of provinces
+} AdjacencyPairs;
 
-    return CLITERAL(Rectangle){ul_t.x, ul_t.y, lr_t.x - ul_t.x, lr_t.y - ul_t.y }; 
+void adjacency_pairs_add(AdjacencyPairs *p, int a, int b)
+{
+    p->pairs[(a*p->n + b) / 8] |= 1 << ((a*p->n + b) % 8);
+    p->pairs[(b*p->n + a) / 8] |= 1 << ((b*p->n + a) % 8);
 }
 
-void mark_province(Image bw_map, Image color_map, Color target_color, Color mark_color)
+bool adjacency_pairs_has(const AdjacencyPairs *p, int a, int b)
 {
-    for (int px = 0; px < color_map.width; ++px) {
-        for (int py = 0; py < color_map.height; ++py) {
-            Color current_color = GetImageColor(color_map, px, py);
-            if ((current_color.r == target_color.r) && 
-                (current_color.g == target_color.g) && 
-                (current_color.b == target_color.b) && 
-                (current_color.a == target_color.a)) {
-                ImageDrawPixel(&bw_map, px, py, mark_color);
-            }
-        }
-    } 
+    return p->pairs[(a*p->n + b) / 8] & (1 << ((a*p->n + b) % 8));
 }
 
-int mark_province_by_name(Image bw_map, Image color_map, const char *name, Color mark_color)
+// Feeds the next pixel of a row or a column; `label` is 0 for an unlabeled one
+void label_run_step(LabelRun *run, AdjacencyPairs *p, int pos, int label)
 {
-    Province* p = NULL;
-    for (int i = 0; i < hmlen(PROVINCES); ++i) {
-        if (strcmp(name, PROVINCES[i].value) == 0) {
-            p = &PROVINCES[i];
-        } 
+    if ((label != 0) && (label == run->label)) {
+        run->length += 1;
+        return;
     }
 
-    if (p == NULL) return -1;
-
-    printf("(mark_province_by_name) FOUND p!\n");
-    mark_province(bw_map, color_map, GetColor(p->key), mark_color);
+    if ((run->label != 0) && (run->length >= ADJACENCY_MIN_RUN)) {
+        if ((run->last_label != 0) && (run->last_label != run->label) && (run->start - run->last_end - 1 <= ADJACENCY_MAX_GAP)) {
+            adjacency_pairs_add(p, run->last_label - 1, run->label - 1);
+        }
+        run->last_label = run->label;
+        run->last_end = run->start + run->length - 1;
+    }
 
-    return 0; 
+    run->label = label;
+    run->start = pos;
+    run->length = (label != 0) ? 1 : 0;
 }
 
-void quiz(Rec *rec, Province **hidden_province)
+void fill_province_adjacency(Country *country)
 {
-    static bool draw_wrong_msg = false;
-    Province *p;
+    double start = now_seconds();
 
-    static size_t errors_current_round = 0;
+    int width = country->color_map.width;
+    int height = country->color_map.height;
+    const uint16_t *labels = country->labels;
+    int n = hmlen(country->provinces);
 
-    if (!any_provinces_left_to_guess()) {
-        state = VICTORY;
-    }
+    AdjacencyPairs p = { .n = n, .pairs = calloc((n*n + 7) / 8, 1) };
+    LabelRun *columns = calloc(width, sizeof(LabelRun));
+    assert(p.pairs != NULL && columns != NULL && "Buy more RAM lol");
 
-    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-        if (GetMouseX() < GetScreenWidth() * COUNTRIES_PANEL_WIDTH) goto skip_if;
+    for (int y = 0; y < height; ++y) {
+        LabelRun row = {0};
+        for (int x = 0; x < width; ++x) {
+            int label = labels[y * width + x] & ~LABEL_SNAPPED;
 
-        Vector2 mouse = GetScreenToWorld2D(GetMousePosition(), camera);
+            // the runs mostly go on, the length of a gap does not matter
+            if (label == row.label) {
+                row.length += 1;
+            } else {
+                label_run_step(&row, &p, x, label);
+            }
 
-        printf("mouse.x: %.5lf; mouse.y: %.5lf\n", mouse.x, mouse.y);
-        DrawCircle(mouse.x, mouse.y, 10.0, RED);
+            if (label == columns[x].label) {
+                columns[x].length += 1;
+            } else {
+                label_run_step(&columns[x], &p, y, label);
+            }
+        }
+        label_run_step(&row, &p, width, 0);
+    }
+    for (int x = 0; x < width; ++x) {
+        label_run_step(&columns[x], &p, height, 0);
+    }
 
-        printf("ul_corner: (%.5lf, %.5lf); lr_corner: (%.5lf, %.5lf)\n", rec->ul.x, rec->ul.y, rec->lr.x, rec->lr.y);
+    Adjacency *adjacency = &country->adjacency;
+    adjacency->offsets = calloc(n + 1, sizeof(int));
+    assert(adjacency->offsets != NULL && "Buy more RAM lol");
+    for (int i = 0; i < n; ++i) {
+        int count = 0;
+        for (int j = 0; j < n; ++j) {
+            if (adjacency_pairs_has(&p, i, j)) count += 1;
+        }
+        adjacency->offsets[i + 1] = adjacency->offsets[i] + count;
+    }
 
-        if ( (mouse.x < rec->ul.x) || (mouse.x > rec->lr.x) || (mouse.y < rec->ul.y) || (mouse.y > rec->lr.y)) {
-            printf("Click is outside the image!\n");
-        } else {
-            int imgx = (int) ( (mouse.x - (GetScreenWidth()/2 - DEFAULT_IMAGE_SCALE*map_texture.width/2)) / DEFAULT_IMAGE_SCALE);
-            int imgy = (int) ( (mouse.y - (GetScreenHeight()/2 - DEFAULT_IMAGE_SCALE*map_texture.height/2)) / DEFAULT_IMAGE_SCALE);
+    adjacency->neighbors = malloc((adjacency->offsets[n] + 1) * sizeof(uint16_t));
+    assert(adjacency->neighbors != NULL && "Buy more RAM lol");
+    for (int i = 0, k = 0; i < n; ++i) {
+        for (int j = 0; j < n; ++j) {
+            if (adjacency_pairs_has(&p, i, j)) adjacency->neighbors[k++] = j;
+        }
+    }
 
-            Image color_map = COUNTRIES.items[active_map].color_map;
-            Image bw_map    = COUNTRIES.items[active_map].bw_map;
+    free(columns);
+    free(p.pairs);
 
-            Color c = GetImageColor(color_map, imgx, imgy);
-            unsigned int hex = ColorToInt(c); 
+    printf("%s: %d provinces, %d pairs of neighbors in %.2lf ms\n",
+           country->name, n, adjacency->offsets[n] / 2, (now_seconds() - start) * 1e3);
+}
 
-            printf("Click is inside! imgx = %d; imgy = %d; color: (%d, %d, %d, %d) => #%08x\n", 
-                    imgx, imgy, c.r, c.g, c.b, c.a, hex);
+// The neighbors of the province `i`, see `Adjacency`
+const uint16_t *province_neighbors(const Country *country, int i, int *count)
+{
+    *count = country->adjacency.offsets[i + 1] - country->adjacency.offsets[i];
+    return country->adjacency.neighbors + country->adjacency.offsets[i];
+}
 
-            int i = hmgeti(PROVINCES, hex);
-            if (i != -1) {
-                p = &PROVINCES[i];
+/*
+ * Connected components of the provinces: an island province is several pieces of the map, and
+ * the center of its bounding box can well be in the sea. The components are 4-connected and
+ * labeled over the horizontal spans of the same label rather than over the pixels. The image is
+ * cut into strips of rows, every thread unites the touching spans of its strip with a union-find,
+ * and the strips are then stitched together along their edges. The stray antialiased pixels of
+ * the color maps make tiny components, so the ones below COMPONENT_MIN_AREA are dropped unless
+ * there is nothing else.
+ */
+#define COMPONENT_MAX_THREADS 8
+#define COMPONENT_MIN_AREA 16
 
-                if (strcmp(p->value, (*hidden_province)->value) == 0) {
-                    //printf("Province name = %s\n", province_name);
-                    
-                    if (errors_current_round == 0) {
-                        mark_province(bw_map, color_map, c, COLOR_GUESSED_PERFECT_PROVINCE);
-                       
-                    #ifdef DEBUG_SAVE_MAP_TO_PNG    
-                        printf("Writing colored map to temp file!\n");
-                        ExportImage(bw_map, "temp-map.png");
-                    #endif
-                    } else {
-                        mark_province(bw_map, color_map, c, COLOR_GUESSED_WERRORS_PROVINCE);
-                        errors_current_round = 0;
-                    }
+typedef struct {
+    int x0, x1; // inclusive
+    int y;
+    int label;
+    int parent; // union-find
+} Span;
 
-                    UnloadTexture(map_texture);
-                    map_texture = LoadTextureFromImage(bw_map);
+typedef struct {
+    const Country *country;
+    int y0, y1;
+    Span *spans;        // stb_ds array, the parents are local to the strip
+    int first_row_end;  // the spans of the first and the last row of the strip for the stitching
+    int last_row_begin;
+} SpanStrip;
 
-                    (*hidden_province)->guessed = true;
+typedef struct {
+    int label;
+    ProvinceComponent component;
+    double sum_x;
+    double sum_y;
+} ComponentSums;
 
-                    if (any_provinces_left_to_guess()) {
-                        *hidden_province = select_random_province();
-                    } else {
-                        state = VICTORY;
-                        *hidden_province = NULL;
-                        return;
-                    }
+int span_find(Span *spans, int i)
+{
+    while (spans[i].parent != i) {
+        spans[i].parent = spans[spans[i].parent].parent;
+        i = spans[i].parent;
+    }
+    return i;
+}
 
-                } else {
-                    error_counter += 1;
-                    draw_wrong_msg = true;
-
-                    errors_current_round += 1;
-                    if (errors_current_round >= MAX_ERRORS_CURRENT_ROUND) {
-                        unsigned int key = (*hidden_province)->key; 
-                        Color target_color = GetColor(key);
-                        printf("Marking PROVINCE=`%s`; target_color=(%d,%d,%d,%d) = #%06x with INCORRECT_COLOR\n", (*hidden_province)->value,
-                               target_color.r, target_color.g, target_color.b, target_color.a, 
-                               key);
-
-                        mark_province(bw_map, color_map, target_color, COLOR_INCORRECT_PROVINCE);
-                        //mark_province_by_name(bw_map, color_map, "Veracruz", YELLOW);
-                        UnloadTexture(map_texture);
-                        map_texture = LoadTextureFromImage(bw_map);
-
-                        (*hidden_province)->guessed = true;
-                        if (any_provinces_left_to_guess()) {
-                            *hidden_province = select_random_province();
-                        } else {
-                            state = VICTORY;
-                            *hidden_province = NULL;
-                            return;
-                        }
-                        
-                        errors_current_round = 0;
-                    }
-                }
-            } else {
-                printf("Province name unknown! Possibly a border has been clicked. \n\n");
-            }
+void span_union(Span *spans, int a, int b)
+{
+    a = span_find(spans, a);
+    b = span_find(spans, b);
+    if (a < b) spans[b].parent = a;
+    if (b < a) spans[a].parent = b;
+}
+
+// Unites the spans of two consecutive rows that overlap and have the same label
+void span_union_rows(Span *spans, int prev_begin, int prev_end, int begin, int end)
+{
+    int j = prev_begin;
+    for (int i = begin; i < end; ++i) {
+        while ((j < prev_end) && (spans[j].x1 < spans[i].x0)) j += 1;
+
+        for (int k = j; (k < prev_end) && (spans[k].x0 <= spans[i].x1); ++k) {
+            if (spans[k].label == spans[i].label) span_union(spans, i, k);
         }
     }
+}
 
-skip_if:
-    Rectangle status_bar = project_rectangle(CLITERAL(Rectangle) {
-        .x = GetScreenWidth() * COUNTRIES_PANEL_WIDTH,
-        .y = 0.0,
-        .width = GetScreenWidth() * (1.0 - COUNTRIES_PANEL_WIDTH),
-        .height = 65.0});
+void *span_strip_run(void *arg)
+{
+    SpanStrip *strip = arg;
+    int width = strip->country->color_map.width;
+    const uint16_t *labels = strip->country->labels;
 
-    DrawRectangleRec(status_bar, ColorBrightness(COLOR_BACKGROUND, 0.2));
+    int prev_begin = 0;
+    int prev_end = 0;
 
-    float padding = 0.01 * GetScreenHeight();
-    Vector2 pos_find_str = GetScreenToWorld2D(CLITERAL(Vector2) {COUNTRIES_PANEL_WIDTH*GetScreenWidth() + 3*padding, padding}, camera);
+    for (int y = strip->y0; y < strip->y1; ++y) {
+        const uint16_t *row = labels + y * width;
+        int begin = arrlen(strip->spans);
 
-    Vector2 pos_errors_str = GetScreenToWorld2D(CLITERAL(Vector2) {
-            GetScreenWidth() - 270.0, padding 
-            }, camera);
+        for (int x = 0; x < width;) {
+            int label = row[x] & ~LABEL_SNAPPED;
+            int x0 = x;
+            while ((x < width) && ((row[x] & ~LABEL_SNAPPED) == label)) x += 1;
+            if (label == 0) continue;
 
-    BeginShaderMode(shader);
-    DrawTextEx(font, TextFormat("Find '%s'", (*hidden_province)->value), 
-            pos_find_str, HUD_DEFAULT_FONTSIZE / camera.zoom, 0, COLOR_TEXT_DEFAULT);
-    DrawTextEx(font, TextFormat("Error counter: %ld", error_counter), 
-            pos_errors_str, HUD_DEFAULT_FONTSIZE / camera.zoom, 0, COLOR_TEXT_DEFAULT);
-    EndShaderMode();
-   
-    static float lifetime_wrong_msg = HUD_LIFETIME; 
-    if (draw_wrong_msg) {
-        float dt = GetFrameTime();
-        lifetime_wrong_msg -= dt;       
-
-        if (lifetime_wrong_msg > 0) {   
-            const char* text = "Wrong!"; 
-            float fontsize = HUD_LARGE_FONTSIZE / camera.zoom;
-            Vector2 text_len = MeasureTextEx(font, text, fontsize, 0);
-
-            Vector2 text_pos = GetScreenToWorld2D(CLITERAL(Vector2) {
-                GetScreenWidth()/2 - text_len.x/2, 
-                GetScreenHeight()/2 - text_len.y/2 
-            }, camera);
-
-            BeginShaderMode(shader);
-            DrawTextEx(font, text, text_pos, fontsize, 0, RED);
-            EndShaderMode();
-        } else {
-            draw_wrong_msg = false;
-            lifetime_wrong_msg = HUD_LIFETIME;
+            Span span = { .x0 = x0, .x1 = x - 1, .y = y, .label = label, .parent = arrlen(strip->spans) };
+            arrput(strip->spans, span);
         }
+
+        int end = arrlen(strip->spans);
+        if (y > strip->y0) span_union_rows(strip->spans, prev_begin, prev_end, begin, end);
+        if (y == strip->y0) strip->first_row_end = end;
+
+        prev_begin = begin;
+        prev_end = end;
     }
+
+    strip->last_row_begin = prev_begin;
+    return NULL;
 }
 
-void victory() 
+int compare_components(const void *a, const void *b)
 {
-    Rectangle status_bar = project_rectangle(CLITERAL(Rectangle) {
-        .x = GetScreenWidth() * COUNTRIES_PANEL_WIDTH,
-        .y = 0.0,
-        .width = GetScreenWidth() * (1.0 - COUNTRIES_PANEL_WIDTH),
-        .height = 65.0});
+    const ComponentSums *x = a;
+    const ComponentSums *y = b;
+    if (x->label != y->label) return x->label - y->label;
+    return y->component.area - x->component.area;
+}
 
-    DrawRectangleRec(status_bar, ColorBrightness(COLOR_BACKGROUND, 0.2));
+void fill_province_components(Country *country)
+{
+    double start = now_seconds();
 
-    float padding = 0.01 * GetScreenHeight();
+    int height = country->color_map.height;
+    int n = hmlen(country->provinces);
 
-    BeginShaderMode(shader);
-    DrawTextEx(font, TextFormat("Error counter: %ld", error_counter), GetScreenToWorld2D(CLITERAL(Vector2) {
-        GetScreenWidth() - 270.0, padding}, camera),
-        HUD_DEFAULT_FONTSIZE / camera.zoom, 0, COLOR_TEXT_DEFAULT);
-    EndShaderMode();
+    int thread_count = 1;
+#if !defined(PLATFORM_WEB)
+    thread_count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count > COMPONENT_MAX_THREADS) thread_count = COMPONENT_MAX_THREADS;
+    if (thread_count > height) thread_count = height;
+    if (thread_count < 1) thread_count = 1;
+#endif
 
-    Vector2 victory_text_pos = GetScreenToWorld2D(CLITERAL(Vector2) {GetScreenWidth()/2, GetScreenHeight()/2}, camera);
+    SpanStrip strips[COMPONENT_MAX_THREADS] = {0};
+    for (int t = 0; t < thread_count; ++t) {
+        strips[t].country = country;
+        strips[t].y0 = height * t / thread_count;
+        strips[t].y1 = height * (t + 1) / thread_count;
+    }
 
-    BeginShaderMode(shader);
-    DrawTextEx(font, "Victory!", victory_text_pos, HUD_LARGE_FONTSIZE / camera.zoom, 0, COLOR_VICTORY);
-    EndShaderMode();
-}
+#if !defined(PLATFORM_WEB)
+    pthread_t threads[COMPONENT_MAX_THREADS];
+    for (int t = 1; t < thread_count; ++t) {
+        pthread_create(&threads[t], NULL, span_strip_run, &strips[t]);
+    }
+    span_strip_run(&strips[0]);
+    for (int t = 1; t < thread_count; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+#else
+    span_strip_run(&strips[0]);
+#endif
 
-void learn(Rec *rec)
-{
-    static bool show_warning_msg = false;
-    static bool show_province_name = false;
- 
-    /*
-     * The name of the clicked province is displayed using the pointer `p`.
-     * The pointer p is outdated if the `active_map` has changed between the `learn` calls. 
-     * We must first check for this before utilizing the pointer.
-     */
-    static ActiveMap local_active_map = 0; 
-    static Province *p = NULL;
+    // the strips go one after another, with their parents shifted
+    Span *spans = NULL;
+    int base[COMPONENT_MAX_THREADS + 1] = {0};
+    for (int t = 0; t < thread_count; ++t) {
+        base[t] = arrlen(spans);
+        Span *dst = arraddnptr(spans, arrlen(strips[t].spans));
+        for (int i = 0; i < arrlen(strips[t].spans); ++i) {
+            dst[i] = strips[t].spans[i];
+            dst[i].parent += base[t];
+        }
+        arrfree(strips[t].spans);
+    }
+    base[thread_count] = arrlen(spans);
 
-    int screen_width = GetScreenWidth();
-    int screen_height = GetScreenHeight();
+    for (int t = 1; t < thread_count; ++t) {
+        span_union_rows(spans, base[t - 1] + strips[t - 1].last_row_begin, base[t],
+                        base[t], base[t] + strips[t].first_row_end);
+    }
 
-    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-        if (GetMouseX() < GetScreenWidth() * COUNTRIES_PANEL_WIDTH) goto skip_if;
+    // every root is a component
+    ComponentSums *sums = NULL;
+    int *component_of = malloc(arrlen(spans) * sizeof(int));
+    assert(component_of != NULL && "Buy more RAM lol");
 
-        Vector2 mouse = GetScreenToWorld2D(GetMousePosition(), camera);
+    for (int i = 0; i < arrlen(spans); ++i) {
+        Span span = spans[i];
+        int root = span_find(spans, i);
 
-        printf("mouse.x: %.5lf; mouse.y: %.5lf\n", mouse.x, mouse.y);
-        DrawCircle(mouse.x, mouse.y, 10.0, RED);
+        if (root == i) {
+            component_of[i] = arrlen(sums);
+            ComponentSums c = {
+                .label = span.label,
+                .component.box = { INT_MAX, INT_MAX, INT_MIN, INT_MIN },
+            };
+            arrput(sums, c);
+        }
 
-        printf("ul_corner: (%.5lf, %.5lf); lr_corner: (%.5lf, %.5lf)\n", rec->ul.x, rec->ul.y, rec->lr.x, rec->lr.y);
+        ComponentSums *c = &sums[component_of[root]];
+        int length = span.x1 - span.x0 + 1;
+        c->component.area += length;
+        c->sum_x += length * (span.x0 + span.x1) / 2.0;
+        c->sum_y += (double) length * span.y;
+
+        ProvinceBox *box = &c->component.box;
+        if (span.x0 < box->x0) box->x0 = span.x0;
+        if (span.y < box->y0) box->y0 = span.y;
+        if (span.x1 > box->x1) box->x1 = span.x1;
+        if (span.y > box->y1) box->y1 = span.y;
+    }
 
-        if ( (mouse.x < rec->ul.x) || (mouse.x > rec->lr.x) || (mouse.y < rec->ul.y) || (mouse.y > rec->lr.y)) {
-            printf("Click is outside the image!\n");
-        } else {
-            int imgx = (int) ( (mouse.x - (screen_width/2 - DEFAULT_IMAGE_SCALE*rec->width/2)) / DEFAULT_IMAGE_SCALE);
-            int imgy = (int) ( (mouse.y - (screen_height/2 - DEFAULT_IMAGE_SCALE*rec->height/2)) / DEFAULT_IMAGE_SCALE);
+    qsort(sums, arrlen(sums), sizeof(ComponentSums), compare_components);
 
-            Image color_map = COUNTRIES.items[active_map].color_map;
-            Image bw_map    = COUNTRIES.items[active_map].bw_map;
+    country->component_offsets = calloc(n + 1, sizeof(int));
+    assert(country->component_offsets != NULL && "Buy more RAM lol");
 
-            Color c = GetImageColor(color_map, imgx, imgy);
-            unsigned int hex = ColorToInt(c);
+    int last = -1;
+    for (int i = 0; i < arrlen(sums); ++i) {
+        ComponentSums *c = &sums[i];
+        int province = c->label - 1;
+        if ((province == last) && (c->component.area < COMPONENT_MIN_AREA)) continue;
+        last = province;
 
-            printf("Click is inside! imgx = %d; imgy = %d; color: (%d, %d, %d, %d) => #%08x\n", 
-                    imgx, imgy, c.r, c.g, c.b, c.a, hex);
+        c->component.centroid = CLITERAL(Vector2) { c->sum_x / c->component.area, c->sum_y / c->component.area };
+        arrput(country->components, c->component);
+        country->component_offsets[province + 1] += 1;
+    }
+    for (int i = 0; i < n; ++i) {
+        country->component_offsets[i + 1] += country->component_offsets[i];
+    }
 
-            int i = hmgeti(PROVINCES, hex);
+    printf("%s: %d spans, %d components of %d provinces in %.2lf ms on %d threads\n",
+           country->name, (int) arrlen(spans), (int) arrlen(country->components), n,
+           (now_seconds() - start) * 1e3, thread_count);
 
-            if (i != -1) {
-                p = &PROVINCES[i];
+    free(component_of);
+    arrfree(sums);
+    arrfree(spans);
+}
 
-                int min_x = INT_MAX;
-                int max_x = INT_MIN;
-                int min_y = INT_MAX;
-                int max_y = INT_MIN;
+// The components of the province `i`, the largest one first
+const ProvinceComponent *province_components(const Country *country, int i, int *count)
+{
+    *count = country->component_offsets[i + 1] - country->component_offsets[i];
+    return country->components + country->component_offsets[i];
+}
 
-                for (int px = 0; px < color_map.width; ++px) {
-                    for (int py = 0; py < color_map.height; ++py) {
-                        Color current_color = GetImageColor(color_map, px, py);
+/*
+ * Label anchors: the pole of inaccessibility of every province, the pixel farthest from its edge.
+ * Unlike the center of the box or the centroid it is inside the province even when the province
+ * is concave or in pieces. It is found with the squared Euclidean distance transform of the box
+ * of the largest component, where every pixel that is not of the province is a zero, and the box
+ * is framed with zeros so the edge of the image counts as an edge.
+ */
+#define EDT_INF 1e20
 
-                        if ((current_color.r == c.r) && 
-                            (current_color.g == c.g) && 
-                            (current_color.b == c.b) && 
-                            (current_color.a == c.a)) {
+double parabola_intersection(const double *f, int q, int p)
+{
+    return ((f[q] + (double) q*q) - (f[p] + (double) p*p)) / (2.0*(q - p));
+}
 
-                            ImageDrawPixel(&bw_map, px, py, COLOR_LEARN_PROVINCE);
-                            if (px > max_x) max_x = px;
-                            if (px < min_x) min_x = px;
-                            if (py > max_y) max_y = py;
-                            if (py < min_y) min_y = py;
-                        }
-                    }
-                }
-                
-                UnloadTexture(map_texture);
-                map_texture = LoadTextureFromImage(bw_map);
+// One dimension of the squared distance transform of Felzenszwalb and Huttenlocher: the lower envelope of the parabolas
+void distance_transform_1d(const double *f, double *d, int n, int *v, double *z)
+{
+    int k = 0;
+    v[0] = 0;
+    z[0] = -EDT_INF;
+    z[1] = EDT_INF;
+
+    for (int q = 1; q < n; ++q) {
+        double s = parabola_intersection(f, q, v[k]);
+        while (s <= z[k]) {
+            k -= 1;
+            s = parabola_intersection(f, q, v[k]);
+        }
 
-                p->center = CLITERAL(Vector2) {
-                    (min_x + max_x)/2*DEFAULT_IMAGE_SCALE + (screen_width/2 - DEFAULT_IMAGE_SCALE*rec->width/2),
-                    (min_y + max_y)/2*DEFAULT_IMAGE_SCALE + (screen_height/2 - DEFAULT_IMAGE_SCALE*rec->height/2)
-                };
+        k += 1;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = EDT_INF;
+    }
 
-                local_active_map = active_map;
-                show_province_name = true;
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z[k + 1] < q) k += 1;
+        d[q] = (double) (q - v[k])*(q - v[k]) + f[v[k]];
+    }
+}
 
-            } else {
-                show_warning_msg = true;
+// The buffers of the distance transform, allocated once per country for the largest of its boxes
+typedef struct {
+    double *grid;
+    double *f;
+    double *d;
+    double *z;
+    int *v;
+} AnchorScratch;
+
+// Works in `s`, which `fill_province_anchors` sizes for the largest box of the country
+Vector2 province_anchor(const Country *country, int i, AnchorScratch *s)
+{
+    int count = 0;
+    const ProvinceComponent *components = province_components(country, i, &count);
+    if (count == 0) return CLITERAL(Vector2) { -1, -1 };
+
+    ProvinceBox box = components[0].box;
+    int width = box.x1 - box.x0 + 3;
+    int height = box.y1 - box.y0 + 3;
+
+    double *grid = s->grid;
+    double *f = s->f;
+    double *d = s->d;
+    double *z = s->z;
+    int *v = s->v;
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int px = box.x0 + x - 1;
+            int py = box.y0 + y - 1;
+            bool inside = (x > 0) && (x < width - 1) && (y > 0) && (y < height - 1) &&
+                          ((country->labels[py * country->color_map.width + px] & ~LABEL_SNAPPED) == i + 1);
+            grid[y * width + x] = inside ? EDT_INF : 0.0;
+        }
+    }
+
+    for (int x = 0; x < width; ++x) {
+        for (int y = 0; y < height; ++y) f[y] = grid[y * width + x];
+        distance_transform_1d(f, d, height, v, z);
+        for (int y = 0; y < height; ++y) grid[y * width + x] = d[y];
+    }
+
+    Vector2 anchor = components[0].centroid;
+    double farthest = 0.0;
+    for (int y = 0; y < height; ++y) {
+        distance_transform_1d(grid + y * width, d, width, v, z);
+        for (int x = 0; x < width; ++x) {
+            if (d[x] > farthest) {
+                farthest = d[x];
+                anchor = CLITERAL(Vector2) { box.x0 + x - 1 + 0.5f, box.y0 + y - 1 + 0.5f };
             }
         }
     }
 
-skip_if:
-    static float warning_msg_lifetime = HUD_LIFETIME;
+    return anchor;
+}
+
+void fill_province_anchors(Country *country)
+{
+    double start = now_seconds();
+
+    int n = hmlen(country->provinces);
+    size_t max_area = 0;
+    size_t max_size = 0;
+    for (int i = 0; i < n; ++i) {
+        int count = 0;
+        const ProvinceComponent *components = province_components(country, i, &count);
+        if (count == 0) continue;
+
+        // the box of `province_anchor`, framed with a pixel on every side
+        size_t width = components[0].box.x1 - components[0].box.x0 + 3;
+        size_t height = components[0].box.y1 - components[0].box.y0 + 3;
+        if (width * height > max_area) max_area = width * height;
+        if (width > max_size) max_size = width;
+        if (height > max_size) max_size = height;
+    }
+
+    // shared by all the provinces of the country; calloc so that the compiler can see nothing is read uninitialized
+    AnchorScratch s = {
+        .grid = calloc(max_area + 1, sizeof(double)),
+        .f = calloc(max_size + 1, sizeof(double)),
+        .d = calloc(max_size + 1, sizeof(double)),
+        .z = calloc(max_size + 2, sizeof(double)),
+        .v = calloc(max_size + 1, sizeof(int)),
+    };
+    assert(s.grid != NULL && s.f != NULL && s.d != NULL && s.z != NULL && s.v != NULL && "Buy more RAM lol");
+
+    arrsetlen(country->anchors, n);
+    for (int i = 0; i < n; ++i) {
+        country->anchors[i] = province_anchor(country, i, &s);
+    }
 
-    if (show_warning_msg) {
-        warning_msg_lifetime -= GetFrameTime();
+    free(s.v);
+    free(s.z);
+    free(s.d);
+    free(s.f);
+    free(s.grid);
 
-        if (warning_msg_lifetime > 0) {
-            const char* text = "Click a province"; 
-            float fontsize = HUD_LARGE_FONTSIZE / camera.zoom;
-            Vector2 text_len = MeasureTextEx(font, text, fontsize, 0);
+    printf("%s: label anchors in %.2lf ms\n", country->name, (now_seconds() - start) * 1e3);
+}
 
-            Vector2 text_pos = GetScreenToWorld2D(CLITERAL(Vector2) {
-                GetScreenWidth()/2 - text_len.x/2, 
-                GetScreenHeight()/2 - text_len.y/2 
-            }, camera);
+/*
+ * Borders and the coast are unlabeled, and a click on them used to be lost. The unlabeled pixels
+ * within `radius` of a province take the label of the nearest one, flagged with `LABEL_SNAPPED`,
+ * so the lookup stays a single read and the map shader can still tell them from the provinces.
+ *
+ * The nearest labeled pixel is found with the exact Euclidean distance transform of Felzenszwalb
+ * and Huttenlocher: the nearest one in the same column first, then the lower envelope of the
+ * parabolas rooted at those along every row. Both passes are linear in the number of pixels,
+ * and the columns are swept row by row to stay in the cache.
+ */
+#define SNAP_DEFAULT_RADIUS 8
+#define SNAP_NONE INT8_MAX
+
+void snap_province_labels(Country *country, int radius)
+{
+    if (radius <= 0) return;
+    if (radius > SNAP_NONE - 1) radius = SNAP_NONE - 1;
+
+    int width = country->color_map.width;
+    int height = country->color_map.height;
+    uint16_t *labels = country->labels;
+
+    // the row offset of the nearest labeled pixel of the column, SNAP_NONE if it is beyond the radius
+    int8_t *dy = malloc(width * height);
+    int *last = malloc(width * sizeof(int));
+    assert(dy != NULL && last != NULL && "Buy more RAM lol");
+
+    for (int x = 0; x < width; ++x) last[x] = INT_MIN/2;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int i = y * width + x;
+            if (labels[i] != 0) last[x] = y;
+            dy[i] = (y - last[x] <= radius) ? last[x] - y : SNAP_NONE;
+        }
+    }
 
-            BeginShaderMode(shader);
-            DrawTextEx(font, text, text_pos, fontsize, 0, RED);
-            EndShaderMode();
-        } else {
-            warning_msg_lifetime = HUD_LIFETIME;
-            show_warning_msg = false;
+    for (int x = 0; x < width; ++x) last[x] = INT_MAX/2;
+    for (int y = height - 1; y >= 0; --y) {
+        for (int x = 0; x < width; ++x) {
+            int i = y * width + x;
+            if (labels[i] != 0) last[x] = y;
+            if ((last[x] - y <= radius) && (last[x] - y < abs(dy[i]))) dy[i] = last[x] - y;
         }
     }
 
-    static float province_name_lifetime = 3*HUD_LIFETIME;
+    // the envelope of the parabolas (x - v)^2 + dy(v)^2 over the row
+    int *v = malloc(width * sizeof(int));
+    double *z = malloc((width + 1) * sizeof(double));
+    assert(v != NULL && z != NULL && "Buy more RAM lol");
+
+    size_t snapped = 0;
+    for (int y = 0; y < height; ++y) {
+        const int8_t *row = dy + y * width;
+
+        int k = -1;
+        for (int q = 0; q < width; ++q) {
+            if (row[q] == SNAP_NONE) continue;
+
+            double fq = row[q] * row[q] + (double) q * q;
+            double s = -INFINITY;
+            while (k >= 0) {
+                double fv = row[v[k]] * row[v[k]] + (double) v[k] * v[k];
+                s = (fq - fv) / (2.0 * (q - v[k]));
+                if (s > z[k]) break;
+                k -= 1;
+            }
+            if (k < 0) s = -INFINITY;
 
-    if (show_province_name) {
-        if (active_map != local_active_map) return;
+            k += 1;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = INFINITY;
+        }
+        if (k < 0) continue;
 
-        province_name_lifetime -= GetFrameTime();
+        k = 0;
+        for (int x = 0; x < width; ++x) {
+            while (z[k + 1] < x) k += 1;
 
-        if (province_name_lifetime > 0) {
-            float fontsize = 40 / camera.zoom;
-            Vector2 name_len = MeasureTextEx(font, p->value, fontsize, 0);
+            int i = y * width + x;
+            if (labels[i] != 0) continue;
 
-            Vector2 name_pos = CLITERAL(Vector2) {
-                p->center.x - name_len.x/2,
-                p->center.y - name_len.y/2
-            };
+            int dx = x - v[k];
+            int dv = row[v[k]];
+            if (dx*dx + dv*dv > radius*radius) continue;
 
-            BeginShaderMode(shader);
-            DrawTextEx(font, p->value, name_pos, fontsize, 0, RED);
-            EndShaderMode();
-        } else {
-            province_name_lifetime = 3*HUD_LIFETIME;
-            show_province_name = false;
+            // the nearest pixel is labeled, so it has not been snapped itself
+            labels[i] = labels[(y + dv) * width + v[k]] | LABEL_SNAPPED;
+            snapped += 1;
         }
     }
+
+    free(z);
+    free(v);
+    free(last);
+    free(dy);
+
+    printf("%s: %zu border pixels snap to the nearest province within %d px\n", country->name, snapped, radius);
 }
 
-typedef enum {
-    BS_NONE      = 0, // 00
-    BS_HOVEROVER = 1, // 01
-    BS_CLICKED   = 2, // 10
-} Button_State;
+// Returns the index of the province under the pixel of the label map or -1 if there is none
+int country_province_at(const Country *country, int imgx, int imgy)
+{
+    Image color_map = country->color_map;
+    if (country->labels == NULL) {
+        // only in the mesh or on the GPU, see `country_free_labels`
+        return mesh_province_at(country, CLITERAL(Vector2) { imgx + 0.5f, imgy + 0.5f });
+    }
+    if ((imgx < 0) || (imgx >= color_map.width) || (imgy < 0) || (imgy >= color_map.height)) return -1;
+
+    return (int) (country->labels[imgy * color_map.width + imgx] & ~LABEL_SNAPPED) - 1;
+}
 
-int button(Rectangle boundary) 
+// For the GPU and the mesh picking; only the size of the color map is kept
+void country_free_labels(Country *country)
 {
-    Vector2 mouse = GetScreenToWorld2D(GetMousePosition(), camera);
-    int hoverover = CheckCollisionPointRec(mouse, boundary);
-    int clicked = 0;
+    free(country->labels);
+    country->labels = NULL;
+    UnloadImage(country->color_map);
+    country->color_map.data = NULL;
+}
 
-    if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
-        if (hoverover) clicked = 1;
-    }
+/*
+ * Province outlines. Every province is traced in the label raster into closed rings with marching
+ * squares through the pixel centers, and the rings are simplified with Douglas-Peucker at each of
+ * OUTLINE_TOLERANCES. The outlines are drawn as lines, so they stay crisp at any zoom where the
+ * borders of the raster get blocky. Tracing all the countries takes a while, so the outlines are
+ * cooked into the cache, keyed by the hash of the color map, the province table and the parameters,
+ * by `--cook` or by the first start. The saddles of marching squares are split, so the pieces that only touch
+ * at a corner stay apart like the 4-connected components.
+ */
+#define OUTLINE_MAX_ERROR 0.5f     // on the screen, in pixels
+#define OUTLINE_MAGIC 0x314C544F   // "OTL1"
+
+static const float OUTLINE_TOLERANCES[OUTLINE_LEVELS] = { 0.5f, 1.0f, 2.0f, 4.0f }; // in the image pixels
+
+// The crossed edges of a marching squares cell by the corners inside (top-left 8, top-right 4, bottom-right 2,
+// bottom-left 1) in pairs: 0 top, 1 right, 2 bottom, 3 left
+static const int8_t MARCHING_SQUARES[16][4] = {
+    {-1, -1, -1, -1}, {3, 2, -1, -1}, {2, 1, -1, -1}, {3, 1, -1, -1},
+    {0, 1, -1, -1},   {3, 2, 0, 1},   {0, 2, -1, -1}, {3, 0, -1, -1},
+    {3, 0, -1, -1},   {0, 2, -1, -1}, {3, 0, 2, 1},   {0, 1, -1, -1},
+    {3, 1, -1, -1},   {2, 1, -1, -1}, {3, 2, -1, -1}, {-1, -1, -1, -1},
+};
 
-    return (clicked << 1) | hoverover;
+typedef struct {
+    uint64_t a; // the ends, see `outline_point_key`
+    uint64_t b;
+} OutlineSegment;
+
+typedef struct {
+    uint64_t key;
+    int value[2]; // the two segments meeting at the point
+} OutlineJoint;
+
+// The points are on the edges between the pixel centers, so they are kept in doubled coordinates
+uint64_t outline_point_key(int x2, int y2)
+{
+    return ((uint64_t) (uint32_t) x2 << 32) | (uint32_t) y2;
 }
 
-void countries_panel(Rectangle panel_boundary, Province **hidden_province)
+Vector2 outline_point(uint64_t key)
 {
-    DrawRectangleRounded(project_rectangle(panel_boundary), 0.1, 4, COLOR_COUNTRIES_PANEL_BACKGROUND);
+    int x2 = (int) (uint32_t) (key >> 32);
+    int y2 = (int) (uint32_t) key;
+    return CLITERAL(Vector2) { x2 * 0.5f + 0.5f, y2 * 0.5f + 0.5f };
+}
 
-    //float scroll_bar_width = 0.03 * panel_boundary.width;
+bool outline_inside(const Country *country, int label, int x, int y)
+{
+    int width = country->color_map.width;
+    if ((x < 0) || (x >= width) || (y < 0) || (y >= country->color_map.height)) return false;
+    return country->labels[y * width + x] == label; // the snapped pixels are outside
+}
 
-    float panel_padding = 0.03 * panel_boundary.width;
-    float entry_size = 80.0;
+// Appends the points of the closed rings of the province to `points` and where every ring ends to `ring_ends`
+void outline_trace(const Country *country, int i, Vector2 **points, int **ring_ends)
+{
+    ProvinceBox box = country->boxes[i];
+    if (box.x0 > box.x1) return;
+
+    OutlineSegment *segments = NULL;
+    for (int y = box.y0 - 1; y <= box.y1; ++y) {
+        for (int x = box.x0 - 1; x <= box.x1; ++x) {
+            int cell = (outline_inside(country, i + 1, x, y) << 3) |
+                       (outline_inside(country, i + 1, x + 1, y) << 2) |
+                       (outline_inside(country, i + 1, x + 1, y + 1) << 1) |
+                       (outline_inside(country, i + 1, x, y + 1));
+
+            uint64_t edges[4] = {
+                outline_point_key(2*x + 1, 2*y),
+                outline_point_key(2*x + 2, 2*y + 1),
+                outline_point_key(2*x + 1, 2*y + 2),
+                outline_point_key(2*x, 2*y + 1),
+            };
 
-    for (size_t i = 0; i < COUNTRIES.count; ++i) {
-        Country *c = &COUNTRIES.items[i];
-
-        Rectangle menu_entry = project_rectangle(
-            CLITERAL(Rectangle) {
-                .x = panel_boundary.x + panel_padding,
-                .y = panel_boundary.y + panel_padding + i * entry_size,
-                .width = panel_boundary.width - panel_padding * 2,
-                .height = entry_size - panel_padding * 2});
-        
-        Color color;
-        if ((int) i != (int) active_map) {
-            int button_state = button(menu_entry);
-            if (button_state & BS_HOVEROVER) {
-                color = COLOR_PANEL_BUTTON_HOVEROVER;
+            for (int k = 0; (k < 4) && (MARCHING_SQUARES[cell][k] >= 0); k += 2) {
+                OutlineSegment segment = { edges[MARCHING_SQUARES[cell][k]], edges[MARCHING_SQUARES[cell][k + 1]] };
+                arrput(segments, segment);
+            }
+        }
+    }
+
+    // every point is shared by exactly two segments, as the box is framed by the outside
+    OutlineJoint *joints = NULL;
+    for (int s = 0; s < arrlen(segments); ++s) {
+        uint64_t ends[2] = { segments[s].a, segments[s].b };
+        for (int e = 0; e < 2; ++e) {
+            OutlineJoint *joint = hmgetp_null(joints, ends[e]);
+            if (joint == NULL) {
+                OutlineJoint j = { ends[e], { s, -1 } };
+                hmputs(joints, j);
             } else {
-                color = COLOR_PANEL_BUTTON;
+                joint->value[1] = s;
             }
+        }
+    }
 
-            if (button_state & BS_CLICKED) {
-                active_map = i;
-                camera.zoom = 1.0;
+    bool *visited = calloc(arrlen(segments) + 1, sizeof(bool));
+    assert(visited != NULL && "Buy more RAM lol");
 
-                Country* c = reload_country((size_t) active_map);
-                map_texture = LoadTextureFromImage(c->bw_map);
-       
-                fill_provinces(active_map);
+    for (int s = 0; s < arrlen(segments); ++s) {
+        if (visited[s]) continue;
 
-                if (state == VICTORY) {
-                    state = QUIZ;
-                }
+        int start = arrlen(*points);
+        uint64_t first = segments[s].a;
+        uint64_t current = segments[s].b;
+        int segment = s;
+        visited[s] = true;
+        arrput(*points, outline_point(first));
 
-                *hidden_province = select_random_province();
+        while (current != first) {
+            arrput(*points, outline_point(current));
 
-                error_counter = 0; 
-            }
-        } else {
-            color = COLOR_PANEL_BUTTON_SELECTED;
+            const int *pair = hmgetp(joints, current)->value;
+            segment = (pair[0] == segment) ? pair[1] : pair[0];
+            visited[segment] = true;
+            current = (segments[segment].a == current) ? segments[segment].b : segments[segment].a;
         }
 
-        DrawRectangleRounded(menu_entry, 0.5, 10, color);
-        
-        float fontsize = 50 / camera.zoom;
-        
-        float line_spacing = 0;
-        // TODO: check for multiple newlines
-        if (TextFindIndex(c->display_name, "\n") > 0) line_spacing = 0.55 * fontsize;
-        SetTextLineSpacing(line_spacing);
-
-        Vector2 name_len = MeasureTextEx(font, c->display_name, fontsize, 0);
-        name_len.y += line_spacing;
-   
-        // TODO: the button label is jerky when zooming. No idea why..
-
-        int it = 0;
-        while ((name_len.y > menu_entry.height) || (name_len.x > menu_entry.width)) {
-            fontsize -= 1.0;
-
-            name_len = MeasureTextEx(font, c->display_name, fontsize, 0);
-            name_len.y += line_spacing;     
-            
-            if (it > 10) break;
-            it++;
+        // the slivers of the stray antialiased pixels go away
+        float area = 0;
+        int count = arrlen(*points) - start;
+        for (int k = 0; k < count; ++k) {
+            Vector2 p = (*points)[start + k];
+            Vector2 q = (*points)[start + (k + 1) % count];
+            area += p.x * q.y - q.x * p.y;
+        }
+        if (fabsf(area) / 2 < COMPONENT_MIN_AREA) {
+            arrsetlen(*points, start);
+            continue;
         }
 
-        Vector2 name_pos = CLITERAL(Vector2) {
-            menu_entry.x + menu_entry.width/2 - name_len.x/2, 
-            menu_entry.y + menu_entry.height/2 - name_len.y/2
-        };
-
-        BeginShaderMode(shader);
-        DrawTextEx(font, c->display_name, name_pos, fontsize, 0, WHITE);
-        EndShaderMode();
+        arrput(*ring_ends, arrlen(*points));
     }
+
+    free(visited);
+    hmfree(joints);
+    arrfree(segments);
 }
 
-void control_panel(Rectangle panel_boundary)
+float segment_distance(Vector2 p, Vector2 a, Vector2 b)
 {
-    DrawRectangleRounded(project_rectangle(panel_boundary), 0.2, 7, COLOR_CONTROL_PANEL_BACKGROUND);
-    
+    Vector2 ab = Vector2Subtract(b, a);
+    float length_sqr = Vector2LengthSqr(ab);
+    if (length_sqr == 0) return Vector2Distance(p, a);
+
+    float t = Vector2DotProduct(Vector2Subtract(p, a), ab) / length_sqr;
+    t = Clamp(t, 0.0f, 1.0f);
+    return Vector2Distance(p, Vector2Add(a, Vector2Scale(ab, t)));
+}
+
+// Marks the points of the polyline `points[first..last]` that are kept within the tolerance
+void douglas_peucker(const Vector2 *points, int first, int last, float tolerance, bool *keep)
+{
+    while (last - first > 1) {
+        int farthest = -1;
+        float distance = tolerance;
+        for (int k = first + 1; k < last; ++k) {
+            float d = segment_distance(points[k], points[first], points[last]);
+            if (d > distance) {
+                distance = d;
+                farthest = k;
+            }
+        }
+        if (farthest == -1) return;
+
+        keep[farthest] = true;
+        douglas_peucker(points, first, farthest, tolerance, keep);
+        first = farthest;
+    }
+}
+
+// A closed ring is split in two at the point farthest from its first one
+void outline_simplify(const Vector2 *ring, int count, float tolerance, OutlineLevel *level, int province)
+{
+    Vector2 *closed = malloc((count + 1) * sizeof(Vector2));
+    bool *keep = calloc(count + 1, sizeof(bool));
+    assert(closed != NULL && keep != NULL && "Buy more RAM lol");
+    memcpy(closed, ring, count * sizeof(Vector2));
+    closed[count] = ring[0];
+
+    int farthest = 0;
+    for (int k = 1; k < count; ++k) {
+        if (Vector2DistanceSqr(ring[k], ring[0]) > Vector2DistanceSqr(ring[farthest], ring[0])) farthest = k;
+    }
+
+    keep[0] = keep[farthest] = true;
+    douglas_peucker(closed, 0, farthest, tolerance, keep);
+    douglas_peucker(closed, farthest, count, tolerance, keep);
+
+    OutlineRing r = { .province = province, .start = arrlen(level->points) };
+    for (int k = 0; k < count; ++k) {
+        if (keep[k]) arrput(level->points, ring[k]);
+    }
+    r.count = arrlen(level->points) - r.start;
+
+    if (r.count >= 3) {
+        arrput(level->rings, r);
+    } else {
+        arrsetlen(level->points, r.start);
+    }
+
+    free(keep);
+    free(closed);
+}
+
+void outlines_trace(Country *country)
+{
+    double start = now_seconds();
+
+    Vector2 *points = NULL;
+    int *ring_ends = NULL;
+
+    for (int i = 0; i < hmlen(country->provinces); ++i) {
+        int ring_start = arrlen(ring_ends);
+        int point_start = arrlen(points);
+        outline_trace(country, i, &points, &ring_ends);
+
+        for (int r = ring_start; r < arrlen(ring_ends); ++r) {
+            int begin = (r == ring_start) ? point_start : ring_ends[r - 1];
+            for (int l = 0; l < OUTLINE_LEVELS; ++l) {
+                outline_simplify(points + begin, ring_ends[r] - begin, OUTLINE_TOLERANCES[l], &country->outlines.levels[l], i);
+            }
+        }
+    }
+
+    printf("%s: traced %d rings of %d points into", country->name, (int) arrlen(ring_ends), (int) arrlen(points));
+    for (int l = 0; l < OUTLINE_LEVELS; ++l) {
+        printf(" %d", (int) arrlen(country->outlines.levels[l].points));
+    }
+    printf(" points in %.2lf ms\n", (now_seconds() - start) * 1e3);
+
+    arrfree(ring_ends);
+    arrfree(points);
+}
+
+#if !defined(PLATFORM_WEB)
+typedef struct {
+    uint32_t magic;
+    int32_t ring_counts[OUTLINE_LEVELS];
+    int32_t point_counts[OUTLINE_LEVELS];
+} OutlineCacheHeader;
+
+bool outlines_cache_load(const char *path, Outlines *outlines)
+{
+    if (!FileExists(path)) return false;
+
+    int size = 0;
+    unsigned char *data = LoadFileData(path, &size);
+    if (data == NULL) return false;
+
+    OutlineCacheHeader header = {0};
+    if ((size_t) size >= sizeof(header)) memcpy(&header, data, sizeof(header));
+
+    size_t expected = sizeof(header);
+    for (int l = 0; l < OUTLINE_LEVELS; ++l) {
+        expected += header.ring_counts[l] * sizeof(OutlineRing) + header.point_counts[l] * sizeof(Vector2);
+    }
+    if ((header.magic != OUTLINE_MAGIC) || ((size_t) size != expected)) {
+        fprintf(stderr, "WARNING: ignoring the corrupted outline cache %s\n", path);
+        UnloadFileData(data);
+        return false;
+    }
+
+    const unsigned char *p = data + sizeof(header);
+    for (int l = 0; l < OUTLINE_LEVELS; ++l) {
+        OutlineLevel *level = &outlines->levels[l];
+        memcpy(arraddnptr(level->rings, header.ring_counts[l]), p, header.ring_counts[l] * sizeof(OutlineRing));
+        p += header.ring_counts[l] * sizeof(OutlineRing);
+        memcpy(arraddnptr(level->points, header.point_counts[l]), p, header.point_counts[l] * sizeof(Vector2));
+        p += header.point_counts[l] * sizeof(Vector2);
+    }
+
+    UnloadFileData(data);
+    return true;
+}
+
+void outlines_cache_save(const char *path, const Outlines *outlines)
+{
+    if (!cache_dir_create()) return;
+
+    OutlineCacheHeader header = { .magic = OUTLINE_MAGIC };
+    size_t size = sizeof(header);
+    for (int l = 0; l < OUTLINE_LEVELS; ++l) {
+        header.ring_counts[l] = arrlen(outlines->levels[l].rings);
+        header.point_counts[l] = arrlen(outlines->levels[l].points);
+        size += header.ring_counts[l] * sizeof(OutlineRing) + header.point_counts[l] * sizeof(Vector2);
+    }
+
+    unsigned char *data = malloc(size);
+    assert(data != NULL && "Buy more RAM lol");
+    memcpy(data, &header, sizeof(header));
+
+    unsigned char *p = data + sizeof(header);
+    for (int l = 0; l < OUTLINE_LEVELS; ++l) {
+        memcpy(p, outlines->levels[l].rings, header.ring_counts[l] * sizeof(OutlineRing));
+        p += header.ring_counts[l] * sizeof(OutlineRing);
+        memcpy(p, outlines->levels[l].points, header.point_counts[l] * sizeof(Vector2));
+        p += header.point_counts[l] * sizeof(Vector2);
+    }
+
+    SaveFileData(path, data, size);
+    free(data);
+}
+#endif // PLATFORM_WEB
+
+// With `cook` the outlines are traced again even if they are in the cache
+void load_country_outlines(Country *country, bool cook)
+{
+#if !defined(PLATFORM_WEB)
+    int file_size = 0;
+    unsigned char *file_data = LoadFileData(country->color_map_filename, &file_size);
+    int params[] = { OUTLINE_LEVELS, COMPONENT_MIN_AREA, (int) sizeof(OutlineRing) };
+    uint64_t hash = fnv1a(file_data, file_size, 0xcbf29ce484222325ULL);
+    hash = fnv1a(params, sizeof(params), hash);
+    hash = fnv1a(OUTLINE_TOLERANCES, sizeof(OUTLINE_TOLERANCES), hash);
+    // the rings refer to the provinces by their index in the table, so its order is part of the key
+    for (int i = 0; i < hmlen(country->provinces); ++i) {
+        uint32_t color = (uint32_t) country->provinces[i].key;
+        hash = fnv1a(&color, sizeof(color), hash);
+    }
+    UnloadFileData(file_data);
+
+    const char *cache_path = TextFormat("%s/outlines-%016llx.bin", CACHE_DIR, (unsigned long long) hash);
+    if (!cook && outlines_cache_load(cache_path, &country->outlines)) {
+        printf("Loaded the outlines of %s from %s\n", country->name, cache_path);
+        return;
+    }
+#endif
+
+    outlines_trace(country);
+
+#if !defined(PLATFORM_WEB)
+    outlines_cache_save(cache_path, &country->outlines);
+#endif
+}
+
+// The coarsest level that is still within OUTLINE_MAX_ERROR on the screen
+int outline_level(float zoom)
+{
+    float screen_scale = DEFAULT_IMAGE_SCALE * zoom;
+    int l = 0;
+    while ((l + 1 < OUTLINE_LEVELS) && (OUTLINE_TOLERANCES[l + 1] * screen_scale <= OUTLINE_MAX_ERROR)) l += 1;
+    return l;
+}
+
+void draw_outlines(const Outlines *outlines, Vector2 origin, float zoom, Color color)
+{
+    const OutlineLevel *level = &outlines->levels[outline_level(zoom)];
+    if (arrlen(level->rings) == 0) return;
+
+    rlPushMatrix();
+    rlTranslatef(origin.x, origin.y, 0);
+    rlScalef(DEFAULT_IMAGE_SCALE, DEFAULT_IMAGE_SCALE, 1);
+
+    for (int r = 0; r < arrlen(level->rings); ++r) {
+        OutlineRing ring = level->rings[r];
+        Vector2 *points = level->points + ring.start;
+        DrawLineStrip(points, ring.count, color);
+        DrawLineV(points[ring.count - 1], points[0], color);
+    }
+
+    rlPopMatrix();
+}
+
+/*
+ * Province mesh. The outlines of every province are cut into triangles by ear clipping, so the
+ * whole map is a single vertex buffer drawn in one call with `--mesh`, whatever the resolution of
+ * the maps. The holes of a province are bridged into the ring around them first. The rings of
+ * the outlines are not guaranteed to stay simple after Douglas-Peucker, so when no ear is left
+ * the clipping cuts one off anyway rather than give up on the rest of the province. Only the
+ * triangles with a positive area are emitted, which is the winding `point_in_triangle` expects.
+ */
+#define MESH_MAX_VERTICES 65536 // the indices are 16-bit
+
+float cross_product(Vector2 a, Vector2 b, Vector2 c)
+{
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+float ring_area(const Vector2 *points, int count)
+{
+    float area = 0;
+    for (int k = 0; k < count; ++k) {
+        Vector2 p = points[k];
+        Vector2 q = points[(k + 1) % count];
+        area += p.x * q.y - q.x * p.y;
+    }
+    return area / 2;
+}
+
+// Even-odd rule
+bool point_in_ring(Vector2 p, const Vector2 *points, int count)
+{
+    bool inside = false;
+    for (int k = 0, j = count - 1; k < count; j = k++) {
+        Vector2 a = points[k];
+        Vector2 b = points[j];
+        if (((a.y > p.y) != (b.y > p.y)) && (p.x < a.x + (p.y - a.y) * (b.x - a.x) / (b.y - a.y))) inside = !inside;
+    }
+    return inside;
+}
+
+bool point_in_triangle(Vector2 p, Vector2 a, Vector2 b, Vector2 c)
+{
+    return (cross_product(a, b, p) >= 0) && (cross_product(b, c, p) >= 0) && (cross_product(c, a, p) >= 0);
+}
+
+// Appends the ring reversed if its area has the wrong sign
+void append_ring(Vector2 **polygon, const Vector2 *points, int count, bool positive)
+{
+    bool reverse = (ring_area(points, count) > 0) != positive;
+    for (int k = 0; k < count; ++k) {
+        arrput(*polygon, points[reverse ? count - 1 - k : k]);
+    }
+}
+
+// Splices the hole into the polygon along a bridge from its rightmost point to a visible point of the polygon
+void bridge_hole(Vector2 **polygon, const Vector2 *hole, int hole_count)
+{
+    int m = 0;
+    for (int k = 1; k < hole_count; ++k) {
+        if (hole[k].x > hole[m].x) m = k;
+    }
+    Vector2 hm = hole[m];
+
+    // the nearest edge to the right of the point
+    int count = arrlen(*polygon);
+    Vector2 *p = *polygon;
+    int bridge = -1;
+    float nearest = INFINITY;
+    for (int k = 0; k < count; ++k) {
+        Vector2 a = p[k];
+        Vector2 b = p[(k + 1) % count];
+        if ((a.y == b.y) || ((a.y > hm.y) == (b.y > hm.y))) continue;
+
+        float x = a.x + (hm.y - a.y) * (b.x - a.x) / (b.y - a.y);
+        if ((x >= hm.x) && (x < nearest)) {
+            nearest = x;
+            bridge = (a.x > b.x) ? k : (k + 1) % count;
+        }
+    }
+    if (bridge == -1) return; // the hole is not inside after all
+
+    // a point inside the triangle between the hole, the hit and the end of the edge would block the view,
+    // the one closest in angle to the ray is visible
+    Vector2 hit = { nearest, hm.y };
+    Vector2 end = p[bridge];
+    float best = INFINITY;
+    for (int k = 0; k < count; ++k) {
+        if (Vector2Equals(p[k], end)) continue;
+
+        bool inside = point_in_triangle(p[k], hm, hit, end) || point_in_triangle(p[k], hm, end, hit);
+        if (!inside || (p[k].x <= hm.x)) continue;
+
+        float slope = fabsf(p[k].y - hm.y) / (p[k].x - hm.x);
+        if (slope < best) {
+            best = slope;
+            bridge = k;
+        }
+    }
+
+    // ..., bridge, hole[m], ..., hole[m - 1], hole[m], bridge, ...
+    Vector2 *spliced = NULL;
+    arrsetcap(spliced, count + hole_count + 2);
+    for (int k = 0; k <= bridge; ++k) arrput(spliced, p[k]);
+    for (int k = 0; k <= hole_count; ++k) arrput(spliced, hole[(m + k) % hole_count]);
+    for (int k = bridge; k < count; ++k) arrput(spliced, p[k]);
+
+    arrfree(*polygon);
+    *polygon = spliced;
+}
+
+// The polygon has a positive area; the triangles go to the mesh as the vertices of the province
+void ear_clip(const Vector2 *polygon, int count, int province, ProvinceMesh *mesh)
+{
+    int base = arrlen(mesh->vertices);
+    for (int k = 0; k < count; ++k) {
+        arrput(mesh->vertices, polygon[k]);
+        arrput(mesh->provinces, (uint16_t) province);
+    }
+
+    int *prev = malloc(count * sizeof(int));
+    int *next = malloc(count * sizeof(int));
+    assert(prev != NULL && next != NULL && "Buy more RAM lol");
+    for (int k = 0; k < count; ++k) {
+        prev[k] = (k + count - 1) % count;
+        next[k] = (k + 1) % count;
+    }
+
+    int remaining = count;
+    int i = 0;
+    int stalled = 0;
+    int reversed = 0;
+    while (remaining >= 3) {
+        int a = prev[i];
+        int c = next[i];
+        Vector2 pa = polygon[a], pb = polygon[i], pc = polygon[c];
+        float cross = cross_product(pa, pb, pc);
+
+        bool ear = cross > 0;
+        for (int k = next[c]; ear && (k != a); k = next[k]) {
+            Vector2 p = polygon[k];
+            if (Vector2Equals(p, pa) || Vector2Equals(p, pb) || Vector2Equals(p, pc)) continue;
+            if (point_in_triangle(p, pa, pb, pc)) ear = false;
+        }
+
+        // a collinear point goes without a triangle, and so does a reflex one cut off by force:
+        // its triangle is outside of the polygon and would be wound backwards
+        if (ear || (cross == 0) || (stalled > remaining)) {
+            if (cross < 0) reversed += 1;
+            if (cross > 0) {
+                arrput(mesh->indices, base + a);
+                arrput(mesh->indices, base + i);
+                arrput(mesh->indices, base + c);
+            }
+            next[a] = c;
+            prev[c] = a;
+            remaining -= 1;
+            i = c;
+            stalled = 0;
+        } else {
+            i = c;
+            stalled += 1;
+        }
+    }
+
+    if (reversed > 0) {
+        printf("Province %d: %d reflex corners of a ring of %d points are cut off without triangles\n",
+               province, reversed, count);
+    }
+
+    free(prev);
+    free(next);
+}
+
+typedef struct {
+    OutlineRing ring;
+    float rightmost;
+} HoleOrder;
+
+int compare_holes(const void *a, const void *b)
+{
+    float x = ((const HoleOrder*) a)->rightmost;
+    float y = ((const HoleOrder*) b)->rightmost;
+    return (x < y) - (x > y);
+}
+
+void triangulate_province(const OutlineLevel *level, int first, int last, ProvinceMesh *mesh)
+{
+    // a ring inside an odd number of the others is a hole
+    int count = last - first;
+    bool *hole = calloc(count, sizeof(bool));
+    assert(hole != NULL && "Buy more RAM lol");
+    for (int r = 0; r < count; ++r) {
+        OutlineRing ring = level->rings[first + r];
+        for (int s = 0; s < count; ++s) {
+            OutlineRing other = level->rings[first + s];
+            if ((s != r) && point_in_ring(level->points[ring.start], level->points + other.start, other.count)) hole[r] = !hole[r];
+        }
+    }
+
+    for (int r = 0; r < count; ++r) {
+        if (hole[r]) continue;
+        OutlineRing outer = level->rings[first + r];
+        float outer_area = fabsf(ring_area(level->points + outer.start, outer.count));
+
+        Vector2 *polygon = NULL;
+        append_ring(&polygon, level->points + outer.start, outer.count, true);
+
+        // every hole goes to the smallest ring around it, the rightmost ones first so that their bridges do not cross
+        HoleOrder *holes = NULL;
+        for (int s = 0; s < count; ++s) {
+            OutlineRing ring = level->rings[first + s];
+            Vector2 p = level->points[ring.start];
+            if (!hole[s] || !point_in_ring(p, level->points + outer.start, outer.count)) continue;
+
+            bool nearest = true;
+            for (int t = 0; nearest && (t < count); ++t) {
+                OutlineRing other = level->rings[first + t];
+                if ((t == r) || hole[t] || !point_in_ring(p, level->points + other.start, other.count)) continue;
+                if (fabsf(ring_area(level->points + other.start, other.count)) < outer_area) nearest = false;
+            }
+            if (!nearest) continue;
+
+            HoleOrder order = { .ring = ring, .rightmost = -INFINITY };
+            for (int k = 0; k < ring.count; ++k) order.rightmost = fmaxf(order.rightmost, level->points[ring.start + k].x);
+            arrput(holes, order);
+        }
+        if (holes != NULL) qsort(holes, arrlen(holes), sizeof(HoleOrder), compare_holes);
+
+        for (int h = 0; h < arrlen(holes); ++h) {
+            OutlineRing ring = holes[h].ring;
+            Vector2 *points = NULL;
+            append_ring(&points, level->points + ring.start, ring.count, false);
+            bridge_hole(&polygon, points, ring.count);
+            arrfree(points);
+        }
+
+        ear_clip(polygon, arrlen(polygon), outer.province, mesh);
+
+        arrfree(holes);
+        arrfree(polygon);
+    }
+
+    free(hole);
+}
+
+// The finest level of the outlines that fits the 16-bit indices
+void triangulate_country(Country *country)
+{
+    double start = now_seconds();
+    ProvinceMesh *mesh = &country->mesh;
+
+    for (int l = 0; l < OUTLINE_LEVELS; ++l) {
+        const OutlineLevel *level = &country->outlines.levels[l];
+
+        arrfree(mesh->vertices);
+        arrfree(mesh->provinces);
+        arrfree(mesh->indices);
+        mesh->level = l;
+
+        // the rings are in the order of the provinces
+        for (int first = 0; first < arrlen(level->rings);) {
+            int last = first;
+            while ((last < arrlen(level->rings)) && (level->rings[last].province == level->rings[first].province)) last += 1;
+            triangulate_province(level, first, last, mesh);
+            first = last;
+        }
+
+        if (arrlen(mesh->vertices) <= MESH_MAX_VERTICES) break;
+    }
+
+    printf("%s: %d triangles of %d vertices from the outlines at %.1f px in %.2lf ms\n",
+           country->name, (int) arrlen(mesh->indices) / 3, (int) arrlen(mesh->vertices),
+           OUTLINE_TOLERANCES[mesh->level], (now_seconds() - start) * 1e3);
+}
+
+/*
+ * Triangle grid. A uniform grid over the triangles of the mesh, so that a click is resolved by
+ * the few triangles of one cell with the exact point-in-triangle test, without the label map.
+ * Every triangle goes to all the cells its bounding box touches, in the same CSR layout as
+ * `Adjacency`. A click in none of the triangles, on a border or the coast, goes to the nearest
+ * province within the snap radius like with `snap_province_labels`.
+ */
+#define TRIANGLE_GRID_CELL 32 // in the image pixels
+
+void triangle_grid_cells(const ProvinceMesh *mesh, int t, int *cx0, int *cy0, int *cx1, int *cy1)
+{
+    const TriangleGrid *grid = &mesh->grid;
+    Vector2 a = mesh->vertices[mesh->indices[3*t + 0]];
+    Vector2 b = mesh->vertices[mesh->indices[3*t + 1]];
+    Vector2 c = mesh->vertices[mesh->indices[3*t + 2]];
+
+    *cx0 = Clamp(floorf(fminf(a.x, fminf(b.x, c.x)) / TRIANGLE_GRID_CELL), 0, grid->columns - 1);
+    *cy0 = Clamp(floorf(fminf(a.y, fminf(b.y, c.y)) / TRIANGLE_GRID_CELL), 0, grid->rows - 1);
+    *cx1 = Clamp(floorf(fmaxf(a.x, fmaxf(b.x, c.x)) / TRIANGLE_GRID_CELL), 0, grid->columns - 1);
+    *cy1 = Clamp(floorf(fmaxf(a.y, fmaxf(b.y, c.y)) / TRIANGLE_GRID_CELL), 0, grid->rows - 1);
+}
+
+void index_province_mesh(Country *country)
+{
+    double start = now_seconds();
+    ProvinceMesh *mesh = &country->mesh;
+    TriangleGrid *grid = &mesh->grid;
+
+    grid->columns = (country->color_map.width + TRIANGLE_GRID_CELL - 1) / TRIANGLE_GRID_CELL;
+    grid->rows = (country->color_map.height + TRIANGLE_GRID_CELL - 1) / TRIANGLE_GRID_CELL;
+    int cell_count = grid->columns * grid->rows;
+    int triangle_count = arrlen(mesh->indices) / 3;
+
+    // counted first, then filled at the running offsets
+    grid->offsets = calloc(cell_count + 1, sizeof(int));
+    assert(grid->offsets != NULL && "Buy more RAM lol");
+    for (int t = 0; t < triangle_count; ++t) {
+        int cx0, cy0, cx1, cy1;
+        triangle_grid_cells(mesh, t, &cx0, &cy0, &cx1, &cy1);
+        for (int cy = cy0; cy <= cy1; ++cy) {
+            for (int cx = cx0; cx <= cx1; ++cx) grid->offsets[cy * grid->columns + cx + 1] += 1;
+        }
+    }
+    for (int i = 0; i < cell_count; ++i) {
+        grid->offsets[i + 1] += grid->offsets[i];
+    }
+
+    int *fill = malloc(cell_count * sizeof(int));
+    grid->triangles = malloc((grid->offsets[cell_count] + 1) * sizeof(int));
+    assert(fill != NULL && grid->triangles != NULL && "Buy more RAM lol");
+    memcpy(fill, grid->offsets, cell_count * sizeof(int));
+
+    for (int t = 0; t < triangle_count; ++t) {
+        int cx0, cy0, cx1, cy1;
+        triangle_grid_cells(mesh, t, &cx0, &cy0, &cx1, &cy1);
+        for (int cy = cy0; cy <= cy1; ++cy) {
+            for (int cx = cx0; cx <= cx1; ++cx) grid->triangles[fill[cy * grid->columns + cx]++] = t;
+        }
+    }
+    free(fill);
+
+    printf("%s: %d triangles in %d cells of the grid, %.1f per cell, in %.2lf ms\n",
+           country->name, triangle_count, cell_count, (float) grid->offsets[cell_count] / cell_count,
+           (now_seconds() - start) * 1e3);
+}
+
+// Returns the index of the province at the point of the image or -1 if there is none within the snap radius
+int mesh_province_at(const Country *country, Vector2 point)
+{
+    const ProvinceMesh *mesh = &country->mesh;
+    const TriangleGrid *grid = &mesh->grid;
+    if (grid->offsets == NULL) return -1;
+
+    int cx = floorf(point.x / TRIANGLE_GRID_CELL);
+    int cy = floorf(point.y / TRIANGLE_GRID_CELL);
+    if ((cx < 0) || (cx >= grid->columns) || (cy < 0) || (cy >= grid->rows)) return -1;
+
+    int cell = cy * grid->columns + cx;
+    for (int k = grid->offsets[cell]; k < grid->offsets[cell + 1]; ++k) {
+        int t = grid->triangles[k];
+        Vector2 a = mesh->vertices[mesh->indices[3*t + 0]];
+        Vector2 b = mesh->vertices[mesh->indices[3*t + 1]];
+        Vector2 c = mesh->vertices[mesh->indices[3*t + 2]];
+        if (point_in_triangle(point, a, b, c)) return mesh->provinces[mesh->indices[3*t]];
+    }
+
+    if ((country->snap_radius <= 0) || (country->snap_radius == SNAP_NONE)) return -1;
+
+    // the distance to a triangle outside of it is the distance to its nearest edge
+    float radius = country->snap_radius;
+    int cx0 = Clamp(floorf((point.x - radius) / TRIANGLE_GRID_CELL), 0, grid->columns - 1);
+    int cy0 = Clamp(floorf((point.y - radius) / TRIANGLE_GRID_CELL), 0, grid->rows - 1);
+    int cx1 = Clamp(floorf((point.x + radius) / TRIANGLE_GRID_CELL), 0, grid->columns - 1);
+    int cy1 = Clamp(floorf((point.y + radius) / TRIANGLE_GRID_CELL), 0, grid->rows - 1);
+
+    int nearest = -1;
+    float distance = radius;
+    for (cy = cy0; cy <= cy1; ++cy) {
+        for (cx = cx0; cx <= cx1; ++cx) {
+            cell = cy * grid->columns + cx;
+            for (int k = grid->offsets[cell]; k < grid->offsets[cell + 1]; ++k) {
+                const uint16_t *triangle = &mesh->indices[3*grid->triangles[k]];
+                for (int e = 0; e < 3; ++e) {
+                    float d = segment_distance(point, mesh->vertices[triangle[e]], mesh->vertices[triangle[(e + 1) % 3]]);
+                    if (d <= distance) {
+                        distance = d;
+                        nearest = mesh->provinces[triangle[0]];
+                    }
+                }
+            }
+        }
+    }
+
+    return nearest;
+}
+
+/*
+ * Scanline rasterizer. The rings of the provinces are filled into a label map by the even-odd rule:
+ * every row is crossed at the pixel centers by the edges, then filled between the pairs of the
+ * crossings of every province. The rows are half-open at the ends of the edges, so a vertex counts
+ * once. The rows are split into bands, a band per thread.
+ */
+#define RASTER_MAX_THREADS 8
+
+// An edge of a ring in the pixel coordinates, going down
+typedef struct {
+    float y0;
+    float y1;
+    float x0;   // at y0
+    float dxdy;
+    uint16_t label;
+} RasterEdge;
+
+typedef struct {
+    float x;
+    uint16_t label;
+} RasterCrossing;
+
+typedef struct {
+    const RasterEdge *edges; // sorted by y0
+    int edge_count;
+    uint16_t *labels;
+    int width;
+    int x0;                  // the columns to fill
+    int x1;
+    int y0;                  // the band of rows
+    int y1;
+} RasterBand;
+
+// The edge from a to b with the label, if it is not horizontal
+void raster_add_edge(RasterEdge **edges, Vector2 a, Vector2 b, uint16_t label)
+{
+    if (a.y == b.y) return;
+
+    RasterEdge edge = {
+        .y0 = fminf(a.y, b.y),
+        .y1 = fmaxf(a.y, b.y),
+        .x0 = (a.y < b.y) ? a.x : b.x,
+        .dxdy = (b.x - a.x) / (b.y - a.y),
+        .label = label,
+    };
+    arrput(*edges, edge);
+}
+
+int compare_edges(const void *a, const void *b)
+{
+    float x = ((const RasterEdge*) a)->y0;
+    float y = ((const RasterEdge*) b)->y0;
+    return (x > y) - (x < y);
+}
+
+int compare_crossings(const void *a, const void *b)
+{
+    const RasterCrossing *x = a;
+    const RasterCrossing *y = b;
+    if (x->label != y->label) return x->label - y->label;
+    return (x->x > y->x) - (x->x < y->x);
+}
+
+void *raster_band_run(void *arg)
+{
+    RasterBand *band = arg;
+    int *active = NULL;
+    RasterCrossing *crossings = NULL;
+    int next = 0;
+
+    for (int y = band->y0; y < band->y1; ++y) {
+        float yc = y + 0.5f;
+
+        while ((next < band->edge_count) && (band->edges[next].y0 <= yc)) {
+            arrput(active, next);
+            next += 1;
+        }
+
+        if (crossings != NULL) arrdeln(crossings, 0, arrlen(crossings));
+        for (int i = 0; i < arrlen(active);) {
+            const RasterEdge *edge = &band->edges[active[i]];
+            if (edge->y1 <= yc) {
+                active[i] = arrpop(active);
+                continue;
+            }
+
+            RasterCrossing crossing = { edge->x0 + (yc - edge->y0) * edge->dxdy, edge->label };
+            arrput(crossings, crossing);
+            i += 1;
+        }
+
+        uint16_t *row = band->labels + (size_t) y * band->width;
+        memset(row + band->x0, 0, (band->x1 - band->x0) * sizeof(uint16_t));
+        if (crossings == NULL) continue;
+
+        qsort(crossings, arrlen(crossings), sizeof(RasterCrossing), compare_crossings);
+
+        for (int i = 0; i + 1 < arrlen(crossings); ++i) {
+            if (crossings[i].label != crossings[i + 1].label) continue;
+
+            int x0 = (int) ceilf(crossings[i].x - 0.5f);
+            int x1 = (int) ceilf(crossings[i + 1].x - 0.5f);
+            if (x0 < band->x0) x0 = band->x0;
+            if (x1 > band->x1) x1 = band->x1;
+            for (int x = x0; x < x1; ++x) row[x] = crossings[i].label;
+
+            i += 1;
+        }
+    }
+
+    arrfree(crossings);
+    arrfree(active);
+    return NULL;
+}
+
+// Fills the rectangle from (x0, y0) up to (x1, y1) of the labels, the rest is left as it is; the edges get sorted.
+// Returns the number of the threads.
+int rasterize_edges(RasterEdge *edges, int edge_count, uint16_t *labels, int width, int x0, int y0, int x1, int y1)
+{
+    if ((x0 >= x1) || (y0 >= y1)) return 0;
+    qsort(edges, edge_count, sizeof(RasterEdge), compare_edges);
+
+    int height = y1 - y0;
+    int thread_count = 1;
+#if !defined(PLATFORM_WEB)
+    thread_count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count > RASTER_MAX_THREADS) thread_count = RASTER_MAX_THREADS;
+    if (thread_count > height) thread_count = height;
+    if (thread_count < 1) thread_count = 1;
+#endif
+
+    // a band takes the edges from the ones crossing into it to the ones starting in it
+    RasterBand bands[RASTER_MAX_THREADS] = {0};
+    for (int t = 0; t < thread_count; ++t) {
+        bands[t] = CLITERAL(RasterBand) {
+            .labels = labels,
+            .width = width,
+            .x0 = x0,
+            .x1 = x1,
+            .y0 = y0 + height * t / thread_count,
+            .y1 = y0 + height * (t + 1) / thread_count,
+        };
+
+        int first = 0;
+        while ((first < edge_count) && (edges[first].y0 < bands[t].y0 + 0.5f) && (edges[first].y1 <= bands[t].y0 + 0.5f)) first += 1;
+        int last = first;
+        while ((last < edge_count) && (edges[last].y0 < bands[t].y1)) last += 1;
+
+        // the edges ending above the band in between are skipped as they come
+        bands[t].edges = edges + first;
+        bands[t].edge_count = last - first;
+    }
+
+#if !defined(PLATFORM_WEB)
+    pthread_t threads[RASTER_MAX_THREADS];
+    for (int t = 1; t < thread_count; ++t) {
+        pthread_create(&threads[t], NULL, raster_band_run, &bands[t]);
+    }
+    raster_band_run(&bands[0]);
+    for (int t = 1; t < thread_count; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+#else
+    raster_band_run(&bands[0]);
+#endif
+
+    return thread_count;
+}
+
+/*
+ * SDF font. Generating the distance fields of all the glyphs is a noticeable part of the
+ * startup, so the atlas and the glyph metrics are cached on disk, keyed by the hash of
+ * the font file and of the generation parameters. The atlas is stored raw to load it
+ * with a single read. There is nowhere to keep the cache on the web.
+ */
+#define FONT_GLYPH_COUNT 95
+#define FONT_ATLAS_PADDING 4
+#define FONT_CACHE_MAGIC 0x31464453 // "SDF1"
+
+typedef struct {
+    uint32_t magic;
+    int32_t base_size;
+    int32_t glyph_count;
+    int32_t atlas_width;
+    int32_t atlas_height;
+    int32_t atlas_format;
+} FontCacheHeader;
+
+typedef struct {
+    int32_t value;
+    int32_t offset_x;
+    int32_t offset_y;
+    int32_t advance_x;
+    Rectangle rec;
+} FontCacheGlyph;
+
+#if !defined(PLATFORM_WEB)
+bool font_cache_load(const char *path, Font *font, Image *atlas)
+{
+    if (!FileExists(path)) return false;
+
+    int size = 0;
+    unsigned char *data = LoadFileData(path, &size);
+    if (data == NULL) return false;
+
+    FontCacheHeader header = {0};
+    if ((size_t) size >= sizeof(header)) memcpy(&header, data, sizeof(header));
+
+    size_t glyphs_size = header.glyph_count * sizeof(FontCacheGlyph);
+    size_t atlas_size = GetPixelDataSize(header.atlas_width, header.atlas_height, header.atlas_format);
+    if ((header.magic != FONT_CACHE_MAGIC) || (header.glyph_count <= 0) ||
+        ((size_t) size != sizeof(header) + glyphs_size + atlas_size)) {
+        fprintf(stderr, "WARNING: ignoring the corrupted font cache %s\n", path);
+        UnloadFileData(data);
+        return false;
+    }
+
+    font->baseSize = header.base_size;
+    font->glyphCount = header.glyph_count;
+    font->glyphs = RL_CALLOC(header.glyph_count, sizeof(GlyphInfo));
+    font->recs = RL_CALLOC(header.glyph_count, sizeof(Rectangle));
+
+    const FontCacheGlyph *glyphs = (const FontCacheGlyph*) (data + sizeof(header));
+    for (int i = 0; i < header.glyph_count; ++i) {
+        font->glyphs[i] = CLITERAL(GlyphInfo) {
+            .value = glyphs[i].value,
+            .offsetX = glyphs[i].offset_x,
+            .offsetY = glyphs[i].offset_y,
+            .advanceX = glyphs[i].advance_x,
+        };
+        font->recs[i] = glyphs[i].rec;
+    }
+
+    *atlas = CLITERAL(Image) {
+        .data = RL_MALLOC(atlas_size),
+        .width = header.atlas_width,
+        .height = header.atlas_height,
+        .mipmaps = 1,
+        .format = header.atlas_format,
+    };
+    memcpy(atlas->data, data + sizeof(header) + glyphs_size, atlas_size);
+
+    UnloadFileData(data);
+    return true;
+}
+
+void font_cache_save(const char *path, Font font, Image atlas)
+{
+    if (!cache_dir_create()) return;
+
+    FontCacheHeader header = {
+        .magic = FONT_CACHE_MAGIC,
+        .base_size = font.baseSize,
+        .glyph_count = font.glyphCount,
+        .atlas_width = atlas.width,
+        .atlas_height = atlas.height,
+        .atlas_format = atlas.format,
+    };
+
+    size_t glyphs_size = font.glyphCount * sizeof(FontCacheGlyph);
+    size_t atlas_size = GetPixelDataSize(atlas.width, atlas.height, atlas.format);
+    size_t size = sizeof(header) + glyphs_size + atlas_size;
+
+    unsigned char *data = calloc(size, 1);
+    assert(data != NULL && "Buy more RAM lol");
+    memcpy(data, &header, sizeof(header));
+
+    FontCacheGlyph *glyphs = (FontCacheGlyph*) (data + sizeof(header));
+    for (int i = 0; i < font.glyphCount; ++i) {
+        glyphs[i] = CLITERAL(FontCacheGlyph) {
+            .value = font.glyphs[i].value,
+            .offset_x = font.glyphs[i].offsetX,
+            .offset_y = font.glyphs[i].offsetY,
+            .advance_x = font.glyphs[i].advanceX,
+            .rec = font.recs[i],
+        };
+    }
+    memcpy(data + sizeof(header) + glyphs_size, atlas.data, atlas_size);
+
+    SaveFileData(path, data, size);
+    free(data);
+}
+#endif // PLATFORM_WEB
+
+// The atlas is returned in `atlas` to be uploaded by the caller
+Font load_sdf_font(const unsigned char *file_data, int file_size, Image *atlas)
+{
+    Font font = {0};
+
+#if !defined(PLATFORM_WEB)
+    int params[] = { FONT_SIZE_LOAD, FONT_GLYPH_COUNT, FONT_ATLAS_PADDING, FONT_SDF, (int) sizeof(FontCacheGlyph) };
+    uint64_t hash = fnv1a(file_data, file_size, 0xcbf29ce484222325ULL);
+    hash = fnv1a(params, sizeof(params), hash);
+    const char *cache_path = TextFormat("%s/font-%016llx.bin", CACHE_DIR, (unsigned long long) hash);
+
+    if (font_cache_load(cache_path, &font, atlas)) {
+        printf("Loaded the font atlas from %s\n", cache_path);
+        return font;
+    }
+#endif
+
+    font.baseSize = FONT_SIZE_LOAD;
+    font.glyphCount = FONT_GLYPH_COUNT;
+    font.glyphs = LoadFontData(file_data, file_size, FONT_SIZE_LOAD, 0, FONT_GLYPH_COUNT, FONT_SDF);
+    *atlas = GenImageFontAtlas(font.glyphs, &font.recs, FONT_GLYPH_COUNT, FONT_SIZE_LOAD, FONT_ATLAS_PADDING, 0);
+
+#if !defined(PLATFORM_WEB)
+    font_cache_save(cache_path, font, *atlas);
+#endif
+
+    return font;
+}
+
+/*
+ * Glyph atlas. Only ASCII is baked into the font atlas, which becomes the first page. Any other
+ * codepoint gets its SDF generated on first use and packed into a dynamic page by a shelf packer,
+ * and only the region of the new glyph is uploaded. Glyphs are never evicted, so their indices
+ * stay valid for the whole run.
+ */
+#define GLYPH_PAGE_SIZE 1024
+#define GLYPH_PAGE_PADDING 2
+
+typedef struct {
+    int y;
+    int height;
+    int x; // where the next glyph goes
+} Shelf;
+
+typedef struct {
+    Texture2D texture;
+    Shelf *shelves; // stb_ds array, unused for the baked page
+    int bottom;     // of the last shelf
+} GlyphPage;
+
+typedef struct {
+    int page;
+    Rectangle rec; // in the page
+    int offset_x;
+    int offset_y;
+    int advance_x;
+} AtlasGlyph;
+
+typedef struct {
+    int key;   // codepoint
+    int value; // index of the glyph
+} GlyphSlot;
+
+typedef struct {
+    unsigned char *font_data;
+    int font_data_size;
+    int base_size;
+
+    AtlasGlyph *glyphs; // stb_ds array
+    GlyphSlot *slots;   // stb_ds hashmap
+    GlyphPage *pages;   // stb_ds array
+} GlyphAtlas;
+
+static GlyphAtlas glyph_atlas = {0};
+
+void glyph_atlas_add(GlyphAtlas *a, int codepoint, AtlasGlyph glyph)
+{
+    if (glyph.advance_x == 0) glyph.advance_x = glyph.rec.width;
+
+    hmput(a->slots, codepoint, arrlen(a->glyphs));
+    arrput(a->glyphs, glyph);
+}
+
+// Takes the ownership of the font data, which is needed to generate the glyphs later
+void glyph_atlas_init(GlyphAtlas *a, Font baked, unsigned char *font_data, int font_data_size)
+{
+    a->font_data = font_data;
+    a->font_data_size = font_data_size;
+    a->base_size = baked.baseSize;
+
+    arrput(a->pages, (CLITERAL(GlyphPage) { .texture = baked.texture }));
+    for (int i = 0; i < baked.glyphCount; ++i) {
+        glyph_atlas_add(a, baked.glyphs[i].value, CLITERAL(AtlasGlyph) {
+            .page = 0,
+            .rec = baked.recs[i],
+            .offset_x = baked.glyphs[i].offsetX,
+            .offset_y = baked.glyphs[i].offsetY,
+            .advance_x = baked.glyphs[i].advanceX,
+        });
+    }
+}
+
+GlyphPage glyph_page_new()
+{
+    // gray is white, the distance field goes into alpha, as in the baked atlas
+    Image image = {
+        .data = calloc(GLYPH_PAGE_SIZE * GLYPH_PAGE_SIZE, 2),
+        .width = GLYPH_PAGE_SIZE,
+        .height = GLYPH_PAGE_SIZE,
+        .mipmaps = 1,
+        .format = PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA,
+    };
+    assert(image.data != NULL && "Buy more RAM lol");
+
+    GlyphPage page = { .texture = LoadTextureFromImage(image) };
+    SetTextureFilter(page.texture, TEXTURE_FILTER_BILINEAR);
+    free(image.data);
+
+    return page;
+}
+
+// Puts the rectangle on the lowest shelf it fits into, or on a new one
+bool glyph_page_pack(GlyphPage *page, int width, int height, Rectangle *rec)
+{
+    width += GLYPH_PAGE_PADDING;
+    height += GLYPH_PAGE_PADDING;
+
+    Shelf *best = NULL;
+    for (int i = 0; i < arrlen(page->shelves); ++i) {
+        Shelf *shelf = &page->shelves[i];
+        if ((shelf->height < height) || (shelf->x + width > GLYPH_PAGE_SIZE)) continue;
+        if ((best == NULL) || (shelf->height < best->height)) best = shelf;
+    }
+
+    if (best == NULL) {
+        if ((page->bottom + height > GLYPH_PAGE_SIZE) || (width > GLYPH_PAGE_SIZE)) return false;
+
+        arrput(page->shelves, (CLITERAL(Shelf) { .y = page->bottom, .height = height, .x = 0 }));
+        page->bottom += height;
+        best = &arrlast(page->shelves);
+    }
+
+    *rec = CLITERAL(Rectangle) { best->x, best->y, width - GLYPH_PAGE_PADDING, height - GLYPH_PAGE_PADDING };
+    best->x += width;
+
+    return true;
+}
+
+// Returns the index of the glyph, generating it if it is not in the atlas yet
+int glyph_atlas_get(GlyphAtlas *a, int codepoint)
+{
+    int slot = hmgeti(a->slots, codepoint);
+    if (slot >= 0) return a->slots[slot].value;
+
+    AtlasGlyph glyph = { .page = -1 };
+
+    GlyphInfo *info = LoadFontData(a->font_data, a->font_data_size, a->base_size, &codepoint, 1, FONT_SDF);
+    if (info != NULL) {
+        glyph.offset_x = info->offsetX;
+        glyph.offset_y = info->offsetY;
+        glyph.advance_x = info->advanceX;
+
+        Image image = info->image;
+        if ((image.data != NULL) && (image.width > 0) && (image.height > 0)) {
+            // page 0 is the baked ASCII page and is never packed into; a new dynamic page is opened when the last one is full
+            bool packed = (arrlen(a->pages) > 1) && glyph_page_pack(&arrlast(a->pages), image.width, image.height, &glyph.rec);
+            if (!packed) {
+                arrput(a->pages, glyph_page_new());
+                packed = glyph_page_pack(&arrlast(a->pages), image.width, image.height, &glyph.rec);
+            }
+
+            if (packed) {
+                glyph.page = arrlen(a->pages) - 1;
+
+                unsigned char *pixels = malloc(image.width * image.height * 2);
+                assert(pixels != NULL && "Buy more RAM lol");
+                for (int i = 0; i < image.width * image.height; ++i) {
+                    pixels[2*i + 0] = 255;
+                    pixels[2*i + 1] = ((unsigned char*) image.data)[i];
+                }
+                UpdateTextureRec(a->pages[glyph.page].texture, glyph.rec, pixels);
+                free(pixels);
+            }
+        }
+
+        UnloadFontData(info, 1);
+    }
+
+    glyph_atlas_add(a, codepoint, glyph);
+
+    return arrlen(a->glyphs) - 1;
+}
+
+// The baked page belongs to the font
+void glyph_atlas_free(GlyphAtlas *a)
+{
+    for (int i = 0; i < arrlen(a->pages); ++i) {
+        if (i > 0) UnloadTexture(a->pages[i].texture);
+        arrfree(a->pages[i].shelves);
+    }
+    arrfree(a->pages);
+    arrfree(a->glyphs);
+    hmfree(a->slots);
+    UnloadFileData(a->font_data);
+}
+
+typedef enum {
+    PROVINCE_NOT_GUESSED = 0,
+    PROVINCE_GUESSED_PERFECT,
+    PROVINCE_GUESSED_WERRORS,
+    PROVINCE_INCORRECT,
+} ProvinceStatus;
+
+// PCG32 (https://www.pcg-random.org): tiny, fast and gives the same sequence on every platform
+typedef struct {
+    uint64_t state;
+    uint64_t inc;
+} Rng;
+
+uint32_t rng_next(Rng *rng)
+{
+    uint64_t old = rng->state;
+    rng->state = old * 6364136223846793005ULL + rng->inc;
+
+    uint32_t xorshifted = ((old >> 18u) ^ old) >> 27u;
+    uint32_t rot = old >> 59u;
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+// Independent sequences are obtained from the same seed with different streams
+void rng_seed(Rng *rng, uint64_t seed, uint64_t stream)
+{
+    rng->state = 0;
+    rng->inc = (stream << 1u) | 1u;
+    rng_next(rng);
+    rng->state += seed;
+    rng_next(rng);
+}
+
+// Uniform in [0, bound) without the modulo bias
+uint32_t rng_below(Rng *rng, uint32_t bound)
+{
+    uint32_t threshold = -bound % bound;
+    for (;;) {
+        uint32_t r = rng_next(rng);
+        if (r >= threshold) return r % bound;
+    }
+}
+
+// Uniform in [0, 1)
+double rng_uniform(Rng *rng)
+{
+    return rng_next(rng) * (1.0 / 4294967296.0);
+}
+
+/*
+ * The state of a single quiz session. Everything that changes while playing lives here,
+ * the countries are only referenced, so any number of sessions can share one copy of
+ * the country data within a process. The session never touches the window or the GPU
+ * and can be driven headless.
+ */
+typedef struct {
+    const Countries *countries;
+    ActiveMap active_map;
+    GameState state;
+
+    ProvinceStatus *statuses; // stb_ds array, one entry per province of the active map
+    int hidden_province;      // index into the provinces of the active map, -1 if there is none
+    size_t error_counter;
+    size_t errors_current_round;
+
+    Rng rng;
+} Session;
+
+typedef enum {
+    CLICK_NONE = 0, // no quiz is running
+    CLICK_BORDER,   // the pixel does not belong to any province
+    CLICK_CORRECT,
+    CLICK_WRONG,
+} ClickOutcome;
+
+typedef struct {
+    ClickOutcome outcome;
+    int province; // the clicked province, -1 if there is none
+    int marked;   // the province which status has changed, -1 if there is none
+} ClickResult;
+
+const Country* session_country(const Session *s)
+{
+    return &s->countries->items[s->active_map];
+}
+
+int select_random_province(Session *s)
+{
+    int left = 0;
+    for (int i = 0; i < arrlen(s->statuses); ++i) {
+        if (s->statuses[i] == PROVINCE_NOT_GUESSED) left++;
+    }
+
+    if (left == 0) return -1;
+
+    int k = rng_below(&s->rng, left);
+    for (int i = 0; i < arrlen(s->statuses); ++i) {
+        if ((s->statuses[i] == PROVINCE_NOT_GUESSED) && (k-- == 0)) return i;
+    }
+
+    assert(false && "unreachable");
+    return -1;
+}
+
+void session_reset_provinces(Session *s)
+{
+    for (int i = 0; i < arrlen(s->statuses); ++i) {
+        s->statuses[i] = PROVINCE_NOT_GUESSED;
+    }
+
+    s->error_counter = 0;
+    s->errors_current_round = 0;
+}
+
+void session_restart(Session *s)
+{
+    session_reset_provinces(s);
+    s->hidden_province = select_random_province(s);
+    s->state = QUIZ;
+}
+
+void session_learn(Session *s)
+{
+    session_reset_provinces(s);
+    s->hidden_province = -1;
+    s->state = LEARN;
+}
+
+void session_select_map(Session *s, ActiveMap active_map)
+{
+    assert((size_t) active_map < s->countries->count);
+
+    s->active_map = active_map;
+    arrsetlen(s->statuses, hmlen(session_country(s)->provinces));
+
+    if (s->state == LEARN) {
+        session_learn(s);
+    } else {
+        session_restart(s);
+    }
+}
+
+void session_init(Session *s, const Countries *countries, ActiveMap active_map, uint64_t seed, uint64_t stream)
+{
+    *s = (Session) {
+        .countries = countries,
+        .state = QUIZ,
+        .hidden_province = -1,
+    };
+
+    rng_seed(&s->rng, seed, stream);
+
+    session_select_map(s, active_map);
+}
+
+void session_free(Session *s)
+{
+    arrfree(s->statuses);
+}
+
+// `i` is the clicked province, -1 for a border or the outside of the map
+ClickResult session_click_province(Session *s, int i)
+{
+    ClickResult result = { .outcome = CLICK_NONE, .province = -1, .marked = -1 };
+    if ((s->state != QUIZ) || (s->hidden_province == -1)) return result;
+
+    if (i == -1) {
+        result.outcome = CLICK_BORDER;
+        return result;
+    }
+
+    result.province = i;
+
+    if (i == s->hidden_province) {
+        result.outcome = CLICK_CORRECT;
+
+        if (s->errors_current_round == 0) {
+            s->statuses[i] = PROVINCE_GUESSED_PERFECT;
+        } else {
+            s->statuses[i] = PROVINCE_GUESSED_WERRORS;
+            s->errors_current_round = 0;
+        }
+        result.marked = i;
+    } else {
+        result.outcome = CLICK_WRONG;
+
+        s->error_counter += 1;
+        s->errors_current_round += 1;
+        if (s->errors_current_round < MAX_ERRORS_CURRENT_ROUND) return result;
+
+        s->statuses[s->hidden_province] = PROVINCE_INCORRECT;
+        s->errors_current_round = 0;
+        result.marked = s->hidden_province;
+    }
+
+    s->hidden_province = select_random_province(s);
+    if (s->hidden_province == -1) s->state = VICTORY;
+
+    return result;
+}
+
+ClickResult session_click(Session *s, int imgx, int imgy)
+{
+    return session_click_province(s, country_province_at(session_country(s), imgx, imgy));
+}
+
+/*
+ * Text layout cache. Measuring a string walks all of its glyphs and fitting it into a box takes
+ * several measurements, so a layout is computed once per (text, font size, box) and kept until
+ * the cache is cleared on resize. Multi-line text gets a line spacing relative to the font size.
+ */
+#define TEXT_LINE_SPACING 0.55f
+#define TEXT_NO_BOX CLITERAL(Vector2) {0, 0}
+
+typedef struct {
+    int index;        // of the glyph in the atlas
+    Vector2 position; // relative to the upper-left corner of the text
+} TextGlyph;
+
+typedef struct {
+    float requested_fontsize;
+    Vector2 box; // zero if the text is not fitted
+
+    float fontsize;
+    float line_spacing;
+    Vector2 size;
+    TextGlyph *glyphs; // stb_ds array, whitespace is skipped
+} TextLayout;
+
+typedef struct {
+    char *key;
+    TextLayout **value; // stb_ds array, one per requested size of the same text
+} TextLayoutEntry;
+
+static TextLayoutEntry *text_cache = NULL;
+
+// The layouts keep the glyph positions in font units until they are scaled to the final size
+Vector2 text_measure(float width, int lines, float fontsize, float line_spacing)
+{
+    return CLITERAL(Vector2) {
+        width * fontsize / glyph_atlas.base_size,
+        fontsize + (lines - 1) * line_spacing
+    };
+}
+
+bool text_fits(Vector2 size, Vector2 box)
+{
+    return (size.x <= box.x) && (size.y <= box.y);
+}
+
+TextLayout* text_layout_compute(const char *text, float fontsize, Vector2 box)
+{
+    TextLayout *t = calloc(1, sizeof(*t));
+    assert(t != NULL && "Buy more RAM lol");
+
+    t->requested_fontsize = fontsize;
+    t->box = box;
+    t->line_spacing = (strchr(text, '\n') != NULL) ? TEXT_LINE_SPACING * fontsize : 0;
+
+    float width = 0; // of the widest line
+    int lines = 1;
+    float x = 0;
+    int length = TextLength(text);
+
+    for (int i = 0; i < length;) {
+        int bytes = 0;
+        int codepoint = GetCodepointNext(&text[i], &bytes);
+        i += bytes;
+
+        if (codepoint == '\n') {
+            lines += 1;
+            x = 0;
+            continue;
+        }
+
+        int index = glyph_atlas_get(&glyph_atlas, codepoint);
+        if ((codepoint != ' ') && (codepoint != '\t')) {
+            // the line is stored in y for now
+            arrput(t->glyphs, (CLITERAL(TextGlyph) { index, CLITERAL(Vector2) { x, lines - 1 } }));
+        }
+
+        x += glyph_atlas.glyphs[index].advance_x;
+        if (x > width) width = x;
+    }
+
+    t->fontsize = fontsize;
+    t->size = text_measure(width, lines, fontsize, t->line_spacing);
+
+    // the largest integer size that fits: the measured size grows monotonically with the font size
+    if ((box.x > 0) && !text_fits(t->size, box)) {
+        int lo = 1;
+        int hi = (int) ceilf(fontsize) - 1;
+        while (lo < hi) {
+            int mid = (lo + hi + 1) / 2;
+            if (text_fits(text_measure(width, lines, mid, t->line_spacing), box)) lo = mid;
+            else hi = mid - 1;
+        }
+
+        t->fontsize = lo;
+        t->size = text_measure(width, lines, lo, t->line_spacing);
+    }
+
+    float scale = t->fontsize / glyph_atlas.base_size;
+    for (int i = 0; i < arrlen(t->glyphs); ++i) {
+        Vector2 *p = &t->glyphs[i].position;
+        *p = CLITERAL(Vector2) { p->x * scale, p->y * t->line_spacing };
+    }
+
+    return t;
+}
+
+// The returned layout stays valid until `text_cache_clear`
+const TextLayout* text_layout(const char *text, float fontsize, Vector2 box)
+{
+    if (text_cache == NULL) sh_new_strdup(text_cache);
+
+    TextLayout **layouts = shget(text_cache, text);
+    for (int i = 0; i < arrlen(layouts); ++i) {
+        TextLayout *t = layouts[i];
+        if ((t->requested_fontsize == fontsize) && (t->box.x == box.x) && (t->box.y == box.y)) return t;
+    }
+
+    TextLayout *t = text_layout_compute(text, fontsize, box);
+    arrput(layouts, t);
+    shput(text_cache, text, layouts);
+
+    return t;
+}
+
+void text_cache_clear()
+{
+    for (int i = 0; i < shlen(text_cache); ++i) {
+        TextLayout **layouts = text_cache[i].value;
+        for (int j = 0; j < arrlen(layouts); ++j) {
+            arrfree(layouts[j]->glyphs);
+            free(layouts[j]);
+        }
+        arrfree(layouts);
+    }
+    shfree(text_cache);
+}
+
+/*
+ * Text batch. Every Begin/EndShaderMode flushes the raylib batch, so instead of binding the SDF
+ * shader around every string, the glyph quads of a render pass are collected and drawn at the
+ * end of the pass with the shader bound once. They are drawn page by page, so raylib keeps the
+ * quads of every atlas page in a single draw call. The text is drawn on top of everything else
+ * in the pass.
+ */
+typedef struct {
+    int page;
+    Rectangle source; // in the atlas page
+    Rectangle dest;
+    Color tint;
+} TextQuad;
+
+static TextQuad *text_batch = NULL;
+
+void text_batch_add(const TextLayout *t, Vector2 position, Color tint)
+{
+    float scale = t->fontsize / glyph_atlas.base_size;
+
+    for (int i = 0; i < arrlen(t->glyphs); ++i) {
+        const TextGlyph *glyph = &t->glyphs[i];
+        const AtlasGlyph *info = &glyph_atlas.glyphs[glyph->index];
+        if (info->page < 0) continue;
+
+        TextQuad quad = {
+            .page = info->page,
+            .source = info->rec,
+            .dest = {
+                position.x + glyph->position.x + info->offset_x * scale,
+                position.y + glyph->position.y + info->offset_y * scale,
+                info->rec.width * scale,
+                info->rec.height * scale
+            },
+            .tint = tint,
+        };
+        arrput(text_batch, quad);
+    }
+}
+
+void text_batch_flush()
+{
+    if (arrlen(text_batch) == 0) return;
+
+    BeginShaderMode(shader);
+    for (int page = 0; page < arrlen(glyph_atlas.pages); ++page) {
+        Texture2D texture = glyph_atlas.pages[page].texture;
+
+        for (int i = 0; i < arrlen(text_batch); ++i) {
+            if (text_batch[i].page != page) continue;
+            DrawTexturePro(texture, text_batch[i].source, text_batch[i].dest, CLITERAL(Vector2) {0, 0}, 0, text_batch[i].tint);
+        }
+    }
+    EndShaderMode();
+
+    arrdeln(text_batch, 0, arrlen(text_batch));
+}
+
+// Screen-space layout of the UI, recomputed only when the window size changes
+typedef struct {
+    int screen_width;
+    int screen_height;
+
+    Rectangle countries_panel;
+    Rectangle control_panel;
+    Rectangle status_bar;
+    Vector2 find_text_pos;
+    Vector2 errors_text_pos;
+    Vector2 center;
+} Layout;
+
+// Returns true if the window size has changed
+bool layout_update(Layout *l)
+{
+    int width = GetScreenWidth();
+    int height = GetScreenHeight();
+    if ((l->screen_width == width) && (l->screen_height == height)) return false;
+
+    l->screen_width = width;
+    l->screen_height = height;
+
+    l->countries_panel = CLITERAL(Rectangle) {
+        .x = 0,
+        .y = 0,
+        .width = COUNTRIES_PANEL_WIDTH * width,
+        .height = COUNTRIES_PANEL_HEIGHT * height
+    };
+
+    float panel_padding = 0.01;
+    l->control_panel = CLITERAL(Rectangle) {
+        .x = 0,
+        .y = (COUNTRIES_PANEL_HEIGHT + panel_padding) * height,
+        .width = COUNTRIES_PANEL_WIDTH * width,
+        .height = (1.0 - COUNTRIES_PANEL_HEIGHT - 2*panel_padding) * height
+    };
+
+    l->status_bar = CLITERAL(Rectangle) {
+        .x = width * COUNTRIES_PANEL_WIDTH,
+        .y = 0.0,
+        .width = width * (1.0 - COUNTRIES_PANEL_WIDTH),
+        .height = 65.0
+    };
+
+    float padding = 0.01 * height;
+    l->find_text_pos = CLITERAL(Vector2) { COUNTRIES_PANEL_WIDTH*width + 3*padding, padding };
+    l->errors_text_pos = CLITERAL(Vector2) { width - 270.0, padding };
+    l->center = CLITERAL(Vector2) { width/2, height/2 };
+
+    return true;
+}
+
+/*
+ * A panel cached in a render texture together with everything it shows. Drawing the panel
+ * costs a single textured quad until one of these changes.
+ */
+typedef struct {
+    RenderTexture2D target;
+    int hovered; // the button shown under the mouse, -1 if there is none
+    ActiveMap active_map;
+    GameState state;
+} PanelLayer;
+
+void panel_layer_unload(PanelLayer *layer)
+{
+    if (layer->target.id > 0) UnloadRenderTexture(layer->target);
+    layer->target = (RenderTexture2D) {0};
+}
+
+// The HUD strings are formatted and laid out again only when their content changes
+typedef struct {
+    bool valid;
+    const char *province_name;
+    size_t error_counter;
+
+    const TextLayout *find;
+    const TextLayout *errors;
+} Hud;
+
+/*
+ * The "show all names" overlay of the learn mode. The names are laid out for the lowest zoom of
+ * a zoom level, a fraction of an octave: within the level the anchors only move apart while the
+ * names keep their size, so the layout stays free of collisions until the zoom crosses into
+ * another level and nothing is recomputed per frame. The names of the larger provinces go first,
+ * a name that collides is shrunk down to NAMES_MIN_FONTSIZE and hidden if it still does.
+ */
+#define NAMES_LEVELS_PER_OCTAVE 4
+#define NAMES_FONTSIZE 24
+#define NAMES_MIN_FONTSIZE 12
+#define NAMES_SHRINK 0.8f
+#define NAMES_MARGIN 4        // between the names, in pixels
+#define NAMES_GRID_CELL 64    // of the collision grid, in pixels
+
+typedef struct {
+    int province;
+    const TextLayout *text;
+} PlacedName;
+
+typedef struct {
+    bool valid;
+    unsigned int generation; // of the map the names were laid out for
+    int level;
+    PlacedName *names;       // stb_ds array
+} NameOverlay;
+
+// A cell of the uniform collision grid
+typedef struct {
+    uint64_t key;
+    int *value; // stb_ds array of the rectangles in the cell
+} NameGridCell;
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Click-to-photon latency. A click is stamped at the start of the frame that has polled it, which
+ * is as close to the input event as raylib gets. The frame showing its effect is stamped when it
+ * is submitted, right before `EndDrawing()`, and when `EndDrawing()` returns. The latter includes
+ * the buffer swap, but also the sleep of the frame cap unless the low-latency mode is on.
+ */
+typedef struct {
+    double pending;    // start of the frame with the click, negative if there is none
+    double *submitted; // stb_ds arrays, in seconds
+    double *presented;
+} ClickLatency;
+
+void click_latency_print(const char *label, double *latencies)
+{
+    size_t n = arrlen(latencies);
+    if (n == 0) return;
+
+    qsort(latencies, n, sizeof(double), compare_doubles);
+    printf("  %-10s p50 %.2lf ms; p90 %.2lf ms; p95 %.2lf ms; p99 %.2lf ms; max %.2lf ms\n", label,
+           latencies[n*50/100] * 1e3,
+           latencies[n*90/100] * 1e3,
+           latencies[n*95/100] * 1e3,
+           latencies[n*99/100] * 1e3,
+           latencies[n - 1] * 1e3);
+}
+
+void click_latency_report(ClickLatency *l)
+{
+    if (arrlen(l->presented) == 0) return;
+
+    printf("Click-to-photon latency over %zu clicks:\n", (size_t) arrlen(l->presented));
+    click_latency_print("submitted", l->submitted);
+    click_latency_print("presented", l->presented);
+}
+
+/*
+ * GPU picking. The label under the cursor is read back from the label texture itself, so it works
+ * without the CPU copies of the labels. The texel is copied into a pixel buffer object and fenced,
+ * and the buffer is mapped only once the fence has signaled, a frame or two later, so the picking
+ * never waits for the GPU. Pixel buffers and fences need desktop OpenGL 3.3, elsewhere the picking
+ * stays on the CPU. raylib does not wrap them, so the entry points are loaded through GLFW, the
+ * way raylib loads its own.
+ */
+#if !defined(PLATFORM_WEB) && defined(GRAPHICS_API_OPENGL_33)
+    #define GPU_PICKING
+#endif
+
+#if defined(GPU_PICKING)
+#define GPU_PICK_SLOTS 4
+
+#define PICK_GL_UNSIGNED_BYTE              0x1401
+#define PICK_GL_RG                         0x8227
+#define PICK_GL_PIXEL_PACK_BUFFER          0x88EB
+#define PICK_GL_STREAM_READ                0x88E1
+#define PICK_GL_MAP_READ_BIT               0x0001
+#define PICK_GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define PICK_GL_ALREADY_SIGNALED           0x911A
+#define PICK_GL_CONDITION_SATISFIED        0x911C
+
+void *glfwGetProcAddress(const char *name); // raylib is built on GLFW on the desktop
+
+// The GL 3.3 entry points that raylib does not wrap
+typedef struct {
+    void (*GenBuffers)(int n, unsigned int *buffers);
+    void (*DeleteBuffers)(int n, const unsigned int *buffers);
+    void (*BindBuffer)(unsigned int target, unsigned int buffer);
+    void (*BufferData)(unsigned int target, ptrdiff_t size, const void *data, unsigned int usage);
+    void (*ReadPixels)(int x, int y, int width, int height, unsigned int format, unsigned int type, void *pixels);
+    void *(*FenceSync)(unsigned int condition, unsigned int flags);
+    unsigned int (*ClientWaitSync)(void *sync, unsigned int flags, uint64_t timeout);
+    void (*DeleteSync)(void *sync);
+    void *(*MapBufferRange)(unsigned int target, ptrdiff_t offset, ptrdiff_t length, unsigned int access);
+    unsigned char (*UnmapBuffer)(unsigned int target);
+} PickGl;
+
+static PickGl pick_gl = {0};
+
+// Returns false if the context lacks any of them
+bool pick_gl_load(PickGl *gl)
+{
+    gl->GenBuffers = glfwGetProcAddress("glGenBuffers");
+    gl->DeleteBuffers = glfwGetProcAddress("glDeleteBuffers");
+    gl->BindBuffer = glfwGetProcAddress("glBindBuffer");
+    gl->BufferData = glfwGetProcAddress("glBufferData");
+    gl->ReadPixels = glfwGetProcAddress("glReadPixels");
+    gl->FenceSync = glfwGetProcAddress("glFenceSync");
+    gl->ClientWaitSync = glfwGetProcAddress("glClientWaitSync");
+    gl->DeleteSync = glfwGetProcAddress("glDeleteSync");
+    gl->MapBufferRange = glfwGetProcAddress("glMapBufferRange");
+    gl->UnmapBuffer = glfwGetProcAddress("glUnmapBuffer");
+
+    return (gl->GenBuffers != NULL) && (gl->DeleteBuffers != NULL) && (gl->BindBuffer != NULL) &&
+           (gl->BufferData != NULL) && (gl->ReadPixels != NULL) && (gl->FenceSync != NULL) &&
+           (gl->ClientWaitSync != NULL) && (gl->DeleteSync != NULL) && (gl->MapBufferRange != NULL) &&
+           (gl->UnmapBuffer != NULL);
+}
+
+typedef enum {
+    PICK_HOVER,
+    PICK_CLICK,
+} PickKind;
+
+// What a readback was issued for, to be matched against the game when the result comes
+typedef struct {
+    PickKind kind;
+    unsigned int generation; // of the map, see `game_reload_map`
+    int imgx;
+    int imgy;
+    double frame_start;      // of the frame that has polled the click
+} PickRequest;
+
+typedef struct {
+    PickRequest request;
+    int province;
+} PickResult;
+
+typedef struct {
+    unsigned int fbo; // with the label texture attached
+    unsigned int pbo[GPU_PICK_SLOTS];
+    void *fence[GPU_PICK_SLOTS]; // NULL if the slot is free
+    PickRequest requests[GPU_PICK_SLOTS];
+} GpuPicker;
+
+static GpuPicker gpu_picker = {0};
+
+// Returns false if the picking has to stay on the CPU
+bool gpu_picker_init(GpuPicker *p)
+{
+    if (!pick_gl_load(&pick_gl)) {
+        fprintf(stderr, "WARNING: no pixel buffers or fences in this GL context, GPU picking is off\n");
+        return false;
+    }
+
+    pick_gl.GenBuffers(GPU_PICK_SLOTS, p->pbo);
+    for (int i = 0; i < GPU_PICK_SLOTS; ++i) {
+        // a single RG texel, padded to the default pack alignment
+        pick_gl.BindBuffer(PICK_GL_PIXEL_PACK_BUFFER, p->pbo[i]);
+        pick_gl.BufferData(PICK_GL_PIXEL_PACK_BUFFER, 4, NULL, PICK_GL_STREAM_READ);
+    }
+    pick_gl.BindBuffer(PICK_GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+}
+
+void gpu_picker_attach(GpuPicker *p, Texture2D labels)
+{
+    if (p->fbo > 0) rlUnloadFramebuffer(p->fbo);
+
+    p->fbo = rlLoadFramebuffer(labels.width, labels.height);
+    rlFramebufferAttach(p->fbo, labels.id, RL_ATTACHMENT_COLOR_CHANNEL0, RL_ATTACHMENT_TEXTURE2D, 0);
+    if (!rlFramebufferComplete(p->fbo)) {
+        fprintf(stderr, "WARNING: the label texture cannot be read back, GPU picking is off\n");
+        rlUnloadFramebuffer(p->fbo);
+        p->fbo = 0;
+    }
+}
+
+// Returns false if all the slots are busy
+bool gpu_picker_request(GpuPicker *p, PickRequest request)
+{
+    if (p->fbo == 0) return false;
+
+    int slot = -1;
+    for (int i = 0; i < GPU_PICK_SLOTS; ++i) {
+        if (p->fence[i] == NULL) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == -1) return false;
+
+    // the batched draws must not land in the label texture
+    rlDrawRenderBatchActive();
+    rlEnableFramebuffer(p->fbo);
+    pick_gl.BindBuffer(PICK_GL_PIXEL_PACK_BUFFER, p->pbo[slot]);
+    pick_gl.ReadPixels(request.imgx, request.imgy, 1, 1, PICK_GL_RG, PICK_GL_UNSIGNED_BYTE, NULL);
+    pick_gl.BindBuffer(PICK_GL_PIXEL_PACK_BUFFER, 0);
+    rlDisableFramebuffer();
+
+    p->fence[slot] = pick_gl.FenceSync(PICK_GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    p->requests[slot] = request;
+
+    return true;
+}
+
+// Collects the finished readbacks without waiting for the others; returns their count
+int gpu_picker_poll(GpuPicker *p, PickResult results[GPU_PICK_SLOTS])
+{
+    int count = 0;
+
+    for (int i = 0; i < GPU_PICK_SLOTS; ++i) {
+        if (p->fence[i] == NULL) continue;
+
+        unsigned int status = pick_gl.ClientWaitSync(p->fence[i], 0, 0);
+        if ((status != PICK_GL_ALREADY_SIGNALED) && (status != PICK_GL_CONDITION_SATISFIED)) continue;
+
+        pick_gl.DeleteSync(p->fence[i]);
+        p->fence[i] = NULL;
+
+        pick_gl.BindBuffer(PICK_GL_PIXEL_PACK_BUFFER, p->pbo[i]);
+        const unsigned char *texel = pick_gl.MapBufferRange(PICK_GL_PIXEL_PACK_BUFFER, 0, 2, PICK_GL_MAP_READ_BIT);
+        int label = (texel != NULL) ? ((texel[0] | (texel[1] << 8)) & ~LABEL_SNAPPED) : 0;
+        pick_gl.UnmapBuffer(PICK_GL_PIXEL_PACK_BUFFER);
+        pick_gl.BindBuffer(PICK_GL_PIXEL_PACK_BUFFER, 0);
+
+        results[count++] = CLITERAL(PickResult) { p->requests[i], label - 1 };
+    }
+
+    return count;
+}
+
+bool gpu_picker_busy(const GpuPicker *p)
+{
+    for (int i = 0; i < GPU_PICK_SLOTS; ++i) {
+        if (p->fence[i] != NULL) return true;
+    }
+    return false;
+}
+
+void gpu_picker_free(GpuPicker *p)
+{
+    for (int i = 0; i < GPU_PICK_SLOTS; ++i) {
+        if (p->fence[i] != NULL) pick_gl.DeleteSync(p->fence[i]);
+    }
+    pick_gl.DeleteBuffers(GPU_PICK_SLOTS, p->pbo);
+    if (p->fbo > 0) rlUnloadFramebuffer(p->fbo);
+    *p = (GpuPicker) {0};
+}
+#endif // GPU_PICKING
+
+typedef enum {
+    RENDER_MAP = 0, // the map textures at the resolution of the maps
+    RENDER_MESH,    // the triangles of `triangulate_country`, see `--mesh`
+    RENDER_VIEW,    // the outlines rasterized at the resolution of the window, see `ViewRaster`
+} RenderMode;
+
+/*
+ * View raster. With `--view-raster` nothing of the size of the maps is resident: the outlines
+ * are rasterized into the labels of the window pixels under the current camera, so the borders
+ * stay a pixel wide and sharp at any zoom. Panning by whole pixels shifts the labels and fills
+ * only the strips coming into the view. Zooming keeps drawing the stale raster stretched until
+ * the camera has settled for VIEW_RASTER_DEBOUNCE seconds, then rasterizes the view again.
+ */
+#define VIEW_RASTER_DEBOUNCE 0.15
+
+typedef struct {
+    int width;
+    int height;
+    uint16_t *labels;          // province index + 1 of every window pixel, 0 if none
+    uint16_t *shown;           // the labels with the borders cleared, for the map shader
+    unsigned char *borders;    // gray-alpha in place of the black-white map: white borders, opaque over the map
+    Texture2D label_texture;
+    Texture2D border_texture;
+
+    Camera2D camera;           // the raster is made for
+    Vector2 origin;            // of the map on the screen under that camera
+    unsigned int generation;   // of the map the raster is made for
+    bool valid;
+    bool pending;              // the camera has zoomed, the raster waits for it to settle
+    Camera2D last_camera;
+    double changed_at;
+} ViewRaster;
+
+/*
+ * A session presented in the window: the camera, the map with the provinces colored by their
+ * status and the HUD animations. The pristine black-white map is drawn as it is, the map shader
+ * colors the provinces from a palette with a texel per province.
+ */
+typedef struct {
+    Session session;
+    Camera2D camera;
+
+    Texture2D map_texture;
+    Texture2D palette;          // province_count x 1, BLANK for the provinces that are not marked
+    Texture2D *label_textures;  // stb_ds array, the labels of every country for the map shader
+    Texture2D label_texture;    // of the active country
+    unsigned int generation;    // bumped on every reload of the map
+    int hovered;                // province under the cursor, -1 if none
+    int hover_x;                // pixel of the last hover, -1 if off the map
+    int hover_y;
+    bool gpu_picking;           // the labels are read back from the GPU, see `GpuPicker`
+    RenderMode render_mode;
+    Mesh *meshes;               // stb_ds array, of every country with `--mesh` instead of the map and the label textures
+    Material mesh_material;     // only its maps are owned, the shader and the palette are set at every draw
+    ViewRaster view;            // with `--view-raster`
+
+    bool draw_wrong_msg;
+    float lifetime_wrong_msg;
+
+    bool show_warning_msg;
+    float warning_msg_lifetime;
+
+    bool show_province_name;
+    float province_name_lifetime;
+    int learn_province;
+    Vector2 learn_province_center; // in the image coordinates
+
+    Layout layout;
+    Hud hud;
+    PanelLayer countries_layer;
+    PanelLayer control_layer;
+    bool show_all_names;
+    NameOverlay names;
+    bool show_outlines;
+
+    bool idle; // render only when there is input or a running animation
+    ClickLatency latency;
+} Game;
+
+bool game_is_animating(const Game *g)
+{
+    return g->draw_wrong_msg || g->show_warning_msg || g->show_province_name;
+}
+
+/*
+ * The time step of the HUD animations. After idling the frame time covers the whole wait for
+ * the input, which would end an animation started by that input before it is ever drawn.
+ */
+float hud_frame_time()
+{
+    float dt = GetFrameTime();
+    return dt > HUD_MAX_FRAME_TIME ? HUD_MAX_FRAME_TIME : dt;
+}
+
+void game_update_hud(Game *g)
+{
+    const Session *s = &g->session;
+    Hud *hud = &g->hud;
+
+    const char *name = NULL;
+    if ((s->state == QUIZ) && (s->hidden_province >= 0)) {
+        name = session_country(s)->provinces[s->hidden_province].value;
+    }
+
+    if (!hud->valid || (hud->province_name != name)) {
+        hud->province_name = name;
+        hud->find = (name != NULL) ? text_layout(TextFormat("Find '%s'", name), HUD_DEFAULT_FONTSIZE, TEXT_NO_BOX) : NULL;
+    }
+
+    if (!hud->valid || (hud->error_counter != s->error_counter)) {
+        hud->error_counter = s->error_counter;
+        hud->errors = text_layout(TextFormat("Error counter: %ld", s->error_counter), HUD_DEFAULT_FONTSIZE, TEXT_NO_BOX);
+    }
+
+    hud->valid = true;
+}
+
+typedef struct {
+    Vector2 ul; // upper-left
+    Vector2 lr; // lower-right
+    float width;
+    float height;
+} Rec;
+
+// Where the map is drawn in the world space
+Rec game_map_rec(const Game *g)
+{
+    Image color_map = session_country(&g->session)->color_map; // only its size is there for sure
+    float posx = g->layout.screen_width/2 - DEFAULT_IMAGE_SCALE * color_map.width/2;
+    float posy = g->layout.screen_height/2 - DEFAULT_IMAGE_SCALE * color_map.height/2;
+
+    return CLITERAL(Rec) {
+        .ul = CLITERAL(Vector2) {posx, posy},
+        .lr = CLITERAL(Vector2) {
+            posx + DEFAULT_IMAGE_SCALE * color_map.width,
+            posy + DEFAULT_IMAGE_SCALE * color_map.height
+        },
+        .width = color_map.width,
+        .height = color_map.height
+    };
+}
+
+Color province_status_color(ProvinceStatus status)
+{
+    switch (status) {
+        case PROVINCE_GUESSED_PERFECT: return COLOR_GUESSED_PERFECT_PROVINCE;
+        case PROVINCE_GUESSED_WERRORS: return COLOR_GUESSED_WERRORS_PROVINCE;
+        case PROVINCE_INCORRECT:       return COLOR_INCORRECT_PROVINCE;
+        default:                       return BLANK;
+    }
+}
+
+void game_reload_map(Game *g)
+{
+    const Country *country = session_country(&g->session);
+
+    if (g->render_mode == RENDER_MAP) {
+        if (g->map_texture.id > 0) UnloadTexture(g->map_texture);
+        g->map_texture = LoadTextureFromImage(country->bw_map);
+        SetTextureFilter(g->map_texture, TEXTURE_FILTER_BILINEAR);
+        g->label_texture = g->label_textures[g->session.active_map];
+    }
+
+    Image palette = GenImageColor(hmlen(country->provinces), 1, BLANK);
+    if (g->palette.id > 0) UnloadTexture(g->palette);
+    g->palette = LoadTextureFromImage(palette);
+    SetTextureFilter(g->palette, TEXTURE_FILTER_POINT);
+    UnloadImage(palette);
+
+#if defined(GPU_PICKING)
+    if (g->gpu_picking) gpu_picker_attach(&gpu_picker, g->label_texture);
+#endif
+
+    // the picks still in flight are for the previous map
+    g->generation += 1;
+    g->hovered = -1;
+    g->hover_x = -1;
+    g->hover_y = -1;
+
+    g->show_province_name = false;
+    g->learn_province = -1;
+}
+
+// Marking is a single texel of the palette, whatever the size of the province
+void game_mark_province(Game *g, int i, Color mark_color)
+{
+    UpdateTextureRec(g->palette, CLITERAL(Rectangle) { i, 0, 1, 1 }, &mark_color);
+}
+
+void view_raster_free(ViewRaster *v)
+{
+    if (v->label_texture.id > 0) UnloadTexture(v->label_texture);
+    if (v->border_texture.id > 0) UnloadTexture(v->border_texture);
+    free(v->labels);
+    free(v->shown);
+    free(v->borders);
+    *v = (ViewRaster) {0};
+}
+
+void view_raster_resize(ViewRaster *v, int width, int height)
+{
+    view_raster_free(v);
+
+    v->width = width;
+    v->height = height;
+    v->labels = calloc((size_t) width * height, sizeof(uint16_t));
+    v->shown = calloc((size_t) width * height, sizeof(uint16_t));
+    v->borders = calloc((size_t) width * height, 2);
+    assert(v->labels != NULL && v->shown != NULL && v->borders != NULL && "Buy more RAM lol");
+
+    Image labels = { .data = v->shown, .width = width, .height = height, .mipmaps = 1, .format = PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA };
+    v->label_texture = LoadTextureFromImage(labels);
+    SetTextureFilter(v->label_texture, TEXTURE_FILTER_POINT);
+
+    Image borders = { .data = v->borders, .width = width, .height = height, .mipmaps = 1, .format = PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA };
+    v->border_texture = LoadTextureFromImage(borders);
+    SetTextureFilter(v->border_texture, TEXTURE_FILTER_POINT);
+}
+
+// The edges of the outlines on the screen at the origin and the zoom; only the ones crossing the rows of the screen matter
+RasterEdge *view_raster_edges(const ViewRaster *v, const Country *country, Vector2 origin, float zoom)
+{
+    const OutlineLevel *level = &country->outlines.levels[outline_level(zoom)];
+    float scale = DEFAULT_IMAGE_SCALE * zoom;
+    RasterEdge *edges = NULL;
+
+    for (int r = 0; r < arrlen(level->rings); ++r) {
+        OutlineRing ring = level->rings[r];
+        const Vector2 *points = level->points + ring.start;
+
+        for (int i = 0; i < ring.count; ++i) {
+            Vector2 a = Vector2Add(origin, Vector2Scale(points[i], scale));
+            Vector2 b = Vector2Add(origin, Vector2Scale(points[(i + 1) % ring.count], scale));
+            if ((fmaxf(a.y, b.y) < 0) || (fminf(a.y, b.y) > v->height)) continue;
+
+            raster_add_edge(&edges, a, b, ring.province + 1);
+        }
+    }
+
+    return edges;
+}
+
+// A pixel is a border if the province changes to the right or below it, just like a line of the black-white maps
+void view_raster_borders(ViewRaster *v, Vector2 origin, Vector2 size)
+{
+    int w = v->width;
+    int h = v->height;
+
+    // the pixels with the centers on the map are opaque
+    int mx0 = Clamp(ceilf(origin.x - 0.5f), 0, w);
+    int mx1 = Clamp(ceilf(origin.x + size.x - 0.5f), 0, w);
+    int my0 = Clamp(ceilf(origin.y - 0.5f), 0, h);
+    int my1 = Clamp(ceilf(origin.y + size.y - 0.5f), 0, h);
+
+    for (int y = 0; y < h; ++y) {
+        const uint16_t *row = v->labels + (size_t) y * w;
+        const uint16_t *below = (y + 1 < h) ? row + w : row;
+        uint16_t *shown = v->shown + (size_t) y * w;
+        unsigned char *borders = v->borders + (size_t) y * w * 2;
+        bool map_row = (y >= my0) && (y < my1);
+
+        for (int x = 0; x < w; ++x) {
+            uint16_t label = row[x];
+            uint16_t right = (x + 1 < w) ? row[x + 1] : label;
+            bool border = (label != right) || (label != below[x]);
+
+            shown[x] = border ? 0 : label;
+            borders[2*x + 0] = border ? 255 : 0;
+            borders[2*x + 1] = (map_row && (x >= mx0) && (x < mx1)) ? 255 : 0;
+        }
+    }
+}
+
+/*
+ * Called every frame before the drawing. Returns true if the raster has changed. The raster
+ * made for another camera is still right where it is drawn, see `draw_view_raster`.
+ */
+bool view_raster_update(Game *g)
+{
+    ViewRaster *v = &g->view;
+    const Country *country = session_country(&g->session);
+    int width = g->layout.screen_width;
+    int height = g->layout.screen_height;
+    if ((width <= 0) || (height <= 0)) return false;
+
+    Camera2D camera = g->camera;
+    double now = GetTime();
+
+    bool full = false;
+    int dx = 0, dy = 0;
+
+    if ((v->width != width) || (v->height != height)) {
+        view_raster_resize(v, width, height);
+        full = true;
+    } else if (!v->valid || (v->generation != g->generation)) {
+        full = true;
+    }
+
+    Rec rec = game_map_rec(g);
+    Vector2 origin = GetWorldToScreen2D(rec.ul, camera);
+
+    if (!full && (camera.zoom == v->camera.zoom)) {
+        // panning is by whole pixels of the mouse, zooming back to the raster may not move it at all
+        Vector2 shift = Vector2Subtract(origin, v->origin);
+        dx = (int) roundf(shift.x);
+        dy = (int) roundf(shift.y);
+        if ((fabsf(shift.x - dx) > 1e-3f) || (fabsf(shift.y - dy) > 1e-3f) || (abs(dx) >= width) || (abs(dy) >= height)) {
+            full = true;
+        } else if ((dx == 0) && (dy == 0)) {
+            v->pending = false;
+            return false;
+        }
+    } else if (!full) {
+        if ((camera.zoom != v->last_camera.zoom) || !Vector2Equals(camera.target, v->last_camera.target) ||
+            !Vector2Equals(camera.offset, v->last_camera.offset)) {
+            v->changed_at = now;
+            v->last_camera = camera;
+        }
+        v->pending = true;
+        if (now - v->changed_at < VIEW_RASTER_DEBOUNCE) return false;
+        full = true;
+    }
+
+    // the shifted raster stays on its whole pixels, the fraction left from the camera is way below a pixel
+    if (!full) origin = Vector2Add(v->origin, CLITERAL(Vector2) { dx, dy });
+
+    double start = now_seconds();
+    RasterEdge *edges = view_raster_edges(v, country, origin, camera.zoom);
+
+    if (full) {
+        int thread_count = rasterize_edges(edges, arrlen(edges), v->labels, width, 0, 0, width, height);
+        printf("Rasterized the view %dx%d of %d edges on %d threads in %.2lf ms\n",
+               width, height, (int) arrlen(edges), thread_count, (now_seconds() - start) * 1e3);
+    } else {
+        // the rows are moved in the direction to not overwrite the ones still to move
+        int x0 = dx > 0 ? 0 : -dx;
+        int count = width - abs(dx);
+        for (int k = 0; k < height - abs(dy); ++k) {
+            int y = (dy > 0) ? height - 1 - k : k;
+            uint16_t *row = v->labels + (size_t) y * width;
+            memmove(row + x0 + dx, v->labels + (size_t) (y - dy) * width + x0, count * sizeof(uint16_t));
+        }
+
+        // the strips that come into the view: the rows across the whole width, the columns in between
+        int ry0 = (dy > 0) ? 0 : height + dy;
+        int ry1 = (dy > 0) ? dy : height;
+        int cx0 = (dx > 0) ? 0 : width + dx;
+        int cx1 = (dx > 0) ? dx : width;
+        rasterize_edges(edges, arrlen(edges), v->labels, width, 0, ry0, width, ry1);
+        rasterize_edges(edges, arrlen(edges), v->labels, width, cx0, (dy > 0) ? dy : 0, cx1, (dy > 0) ? height : height + dy);
+    }
+
+    float scale = DEFAULT_IMAGE_SCALE * camera.zoom;
+    view_raster_borders(v, origin, CLITERAL(Vector2) { rec.width * scale, rec.height * scale });
+    UpdateTexture(v->label_texture, v->shown);
+    UpdateTexture(v->border_texture, v->borders);
+    arrfree(edges);
+
+    v->camera = camera;
+    v->last_camera = camera;
+    v->origin = origin;
+    v->generation = g->generation;
+    v->valid = true;
+    v->pending = false;
+    return true;
+}
+
+// The province index goes in the first texture coordinate
+Mesh upload_province_mesh(const ProvinceMesh *province_mesh)
+{
+    int vertex_count = arrlen(province_mesh->vertices);
+    int index_count = arrlen(province_mesh->indices);
+
+    Mesh mesh = {
+        .vertexCount = vertex_count,
+        .triangleCount = index_count / 3,
+        .vertices = RL_MALLOC(vertex_count * 3 * sizeof(float)),
+        .texcoords = RL_MALLOC(vertex_count * 2 * sizeof(float)),
+        .indices = RL_MALLOC(index_count * sizeof(unsigned short)),
+    };
+    assert(mesh.vertices != NULL && mesh.texcoords != NULL && mesh.indices != NULL && "Buy more RAM lol");
+
+    for (int i = 0; i < vertex_count; ++i) {
+        mesh.vertices[3*i + 0] = province_mesh->vertices[i].x;
+        mesh.vertices[3*i + 1] = province_mesh->vertices[i].y;
+        mesh.vertices[3*i + 2] = 0;
+        mesh.texcoords[2*i + 0] = province_mesh->provinces[i];
+        mesh.texcoords[2*i + 1] = 0;
+    }
+    memcpy(mesh.indices, province_mesh->indices, index_count * sizeof(unsigned short));
+
+    UploadMesh(&mesh, false);
+    return mesh;
+}
+
+// Only RENDER_MAP uploads the labels of the countries, RENDER_VIEW has no textures until the first frame
+void game_init(Game *g, const Countries *countries, ActiveMap active_map, uint64_t seed, RenderMode render_mode)
+{
+    *g = (Game) {
+        .camera = { .zoom = 1.0 },
+        .render_mode = render_mode,
+        .lifetime_wrong_msg = HUD_LIFETIME,
+        .warning_msg_lifetime = HUD_LIFETIME,
+        .province_name_lifetime = 3*HUD_LIFETIME,
+        .learn_province = -1,
+        .latency = { .pending = -1 },
+    };
+
+    bool mesh = render_mode == RENDER_MESH;
+    for (size_t i = 0; mesh && (i < countries->count); ++i) {
+        arrput(g->meshes, upload_province_mesh(&countries->items[i].mesh));
+    }
+    if (mesh) g->mesh_material = LoadMaterialDefault();
+
+    // the labels of all the countries are uploaded at once, so their CPU copies can be dropped afterwards
+    for (size_t i = 0; (render_mode == RENDER_MAP) && (i < countries->count); ++i) {
+        const Country *country = &countries->items[i];
+
+        // the little-endian 16-bit labels go as they are: the low byte is gray, the high byte is alpha
+        Image labels = {
+            .data = country->labels,
+            .width = country->color_map.width,
+            .height = country->color_map.height,
+            .mipmaps = 1,
+            .format = PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA,
+        };
+        Texture2D texture = LoadTextureFromImage(labels);
+        SetTextureFilter(texture, TEXTURE_FILTER_POINT);
+        arrput(g->label_textures, texture);
+    }
+
+    session_init(&g->session, countries, active_map, seed, 0);
+    game_reload_map(g);
+}
+
+void game_free(Game *g)
+{
+    if (g->map_texture.id > 0) UnloadTexture(g->map_texture);
+    for (int i = 0; i < arrlen(g->meshes); ++i) {
+        UnloadMesh(g->meshes[i]);
+    }
+    arrfree(g->meshes);
+    RL_FREE(g->mesh_material.maps); // not `UnloadMaterial`, it would unload the palette
+    view_raster_free(&g->view);
+    UnloadTexture(g->palette);
+    for (int i = 0; i < arrlen(g->label_textures); ++i) {
+        UnloadTexture(g->label_textures[i]);
+    }
+    arrfree(g->label_textures);
+    panel_layer_unload(&g->countries_layer);
+    panel_layer_unload(&g->control_layer);
+    session_free(&g->session);
+    arrfree(g->names.names);
+    arrfree(g->latency.submitted);
+    arrfree(g->latency.presented);
+}
+
+void game_select_map(Game *g, ActiveMap active_map)
+{
+    session_select_map(&g->session, active_map);
+    g->camera.zoom = 1.0;
+    game_reload_map(g);
+}
+
+void game_restart(Game *g)
+{
+    session_restart(&g->session);
+    game_reload_map(g);
+}
+
+void game_learn(Game *g)
+{
+    session_learn(&g->session);
+    game_reload_map(g);
+}
+
+// Returns true if the click has a visible effect
+bool quiz_click(Game *g, int province)
+{
+    Session *s = &g->session;
+    ClickResult result = session_click_province(s, province);
+
+    if (result.outcome == CLICK_BORDER) {
+        printf("Province name unknown! Possibly a border has been clicked. \n\n");
+    } else if (result.outcome == CLICK_WRONG) {
+        g->draw_wrong_msg = true;
+    }
+
+    if (result.marked != -1) {
+        ProvinceStatus status = s->statuses[result.marked];
+        if (status == PROVINCE_INCORRECT) {
+            printf("Marking PROVINCE=`%s` with INCORRECT_COLOR\n", session_country(s)->provinces[result.marked].value);
+        }
+
+        game_mark_province(g, result.marked, province_status_color(status));
+    }
+
+    return (result.outcome == CLICK_CORRECT) || (result.outcome == CLICK_WRONG);
+}
+
+void quiz(Game *g)
+{
+    const Layout *layout = &g->layout;
+
+    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && (GetMouseX() >= layout->countries_panel.width)) {
+        DrawCircleV(GetMousePosition(), 10.0, RED);
+    }
+
+    game_update_hud(g);
+    DrawRectangleRec(layout->status_bar, ColorBrightness(COLOR_BACKGROUND, 0.2));
+
+    if (g->hud.find != NULL) text_batch_add(g->hud.find, layout->find_text_pos, COLOR_TEXT_DEFAULT);
+    text_batch_add(g->hud.errors, layout->errors_text_pos, COLOR_TEXT_DEFAULT);
+
+    if (g->draw_wrong_msg) {
+        g->lifetime_wrong_msg -= hud_frame_time();
+
+        if (g->lifetime_wrong_msg > 0) {
+            const TextLayout *text = text_layout("Wrong!", HUD_LARGE_FONTSIZE, TEXT_NO_BOX);
+            Vector2 text_pos = Vector2Subtract(layout->center, Vector2Scale(text->size, 0.5));
+
+            text_batch_add(text, text_pos, RED);
+        } else {
+            g->draw_wrong_msg = false;
+            g->lifetime_wrong_msg = HUD_LIFETIME;
+        }
+    }
+}
+
+void victory(Game *g)
+{
+    const Layout *layout = &g->layout;
+
+    game_update_hud(g);
+    DrawRectangleRec(layout->status_bar, ColorBrightness(COLOR_BACKGROUND, 0.2));
+
+    text_batch_add(g->hud.errors, layout->errors_text_pos, COLOR_TEXT_DEFAULT);
+    text_batch_add(text_layout("Victory!", HUD_LARGE_FONTSIZE, TEXT_NO_BOX), layout->center, COLOR_VICTORY);
+}
+
+// Returns true if the click has a visible effect
+bool learn_click(Game *g, int i)
+{
+    const Country *country = session_country(&g->session);
+
+    if (i != -1) {
+        game_mark_province(g, i, COLOR_LEARN_PROVINCE);
+
+        g->learn_province = i;
+        g->learn_province_center = country->anchors[i];
+        g->show_province_name = true;
+        g->province_name_lifetime = 3*HUD_LIFETIME;
+    } else {
+        g->show_warning_msg = true;
+    }
+
+    return true;
+}
+
+int name_level(float zoom)
+{
+    return (int) floorf(log2f(zoom) * NAMES_LEVELS_PER_OCTAVE);
+}
+
+uint64_t name_grid_key(int cx, int cy)
+{
+    return ((uint64_t) (uint32_t) cx << 32) | (uint32_t) cy;
+}
+
+// Returns false if the rectangle overlaps any placed one
+bool name_grid_fits(NameGridCell *grid, const Rectangle *placed, Rectangle r)
+{
+    int cx0 = (int) floorf(r.x / NAMES_GRID_CELL), cx1 = (int) floorf((r.x + r.width) / NAMES_GRID_CELL);
+    int cy0 = (int) floorf(r.y / NAMES_GRID_CELL), cy1 = (int) floorf((r.y + r.height) / NAMES_GRID_CELL);
+
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        for (int cx = cx0; cx <= cx1; ++cx) {
+            int *cell = hmget(grid, name_grid_key(cx, cy));
+            for (int i = 0; i < arrlen(cell); ++i) {
+                if (CheckCollisionRecs(r, placed[cell[i]])) return false;
+            }
+        }
+    }
+    return true;
+}
+
+void name_grid_add(NameGridCell **grid, Rectangle r, int index)
+{
+    int cx0 = (int) floorf(r.x / NAMES_GRID_CELL), cx1 = (int) floorf((r.x + r.width) / NAMES_GRID_CELL);
+    int cy0 = (int) floorf(r.y / NAMES_GRID_CELL), cy1 = (int) floorf((r.y + r.height) / NAMES_GRID_CELL);
+
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        for (int cx = cx0; cx <= cx1; ++cx) {
+            uint64_t key = name_grid_key(cx, cy);
+            int *cell = hmget(*grid, key);
+            arrput(cell, index);
+            hmput(*grid, key, cell);
+        }
+    }
+}
+
+typedef struct {
+    int province;
+    int area; // of the largest component
+} ProvinceArea;
+
+int compare_provinces_by_area(const void *a, const void *b)
+{
+    return ((const ProvinceArea*) b)->area - ((const ProvinceArea*) a)->area;
+}
+
+void game_update_name_overlay(Game *g)
+{
+    NameOverlay *overlay = &g->names;
+    int level = name_level(g->camera.zoom);
+    if (overlay->valid && (overlay->generation == g->generation) && (overlay->level == level)) return;
+
+    double start = GetTime();
+    const Country *country = session_country(&g->session);
+    int n = hmlen(country->provinces);
+
+    // the screen scale of the map at the lowest zoom of the level
+    float zoom = exp2f((float) level / NAMES_LEVELS_PER_OCTAVE);
+    float scale = DEFAULT_IMAGE_SCALE * zoom;
+    float fontsize = NAMES_FONTSIZE * sqrtf(zoom);
+
+    ProvinceArea *order = malloc(n * sizeof(ProvinceArea));
+    assert(order != NULL && "Buy more RAM lol");
+    for (int i = 0; i < n; ++i) {
+        int count = 0;
+        const ProvinceComponent *components = province_components(country, i, &count);
+        order[i] = CLITERAL(ProvinceArea) { i, count > 0 ? components[0].area : 0 };
+    }
+    qsort(order, n, sizeof(ProvinceArea), compare_provinces_by_area);
+
+    arrfree(overlay->names);
+    Rectangle *placed = NULL;
+    NameGridCell *grid = NULL;
+    int hidden = 0;
+
+    for (int k = 0; k < n; ++k) {
+        int i = order[k].province;
+        Vector2 anchor = country->anchors[i];
+        if (anchor.x < 0) continue;
+
+        bool fits = false;
+        const TextLayout *text = NULL;
+        Rectangle r = {0};
+
+        for (float size = fontsize; size >= NAMES_MIN_FONTSIZE; size *= NAMES_SHRINK) {
+            text = text_layout(country->provinces[i].value, roundf(size), TEXT_NO_BOX);
+            r = CLITERAL(Rectangle) {
+                anchor.x * scale - text->size.x/2 - NAMES_MARGIN/2,
+                anchor.y * scale - text->size.y/2 - NAMES_MARGIN/2,
+                text->size.x + NAMES_MARGIN,
+                text->size.y + NAMES_MARGIN
+            };
+            fits = name_grid_fits(grid, placed, r);
+            if (fits) break;
+        }
+
+        if (!fits) {
+            hidden += 1;
+            continue;
+        }
+
+        name_grid_add(&grid, r, arrlen(placed));
+        arrput(placed, r);
+        arrput(overlay->names, (CLITERAL(PlacedName) { i, text }));
+    }
+
+    for (int i = 0; i < hmlen(grid); ++i) {
+        arrfree(grid[i].value);
+    }
+    hmfree(grid);
+    arrfree(placed);
+    free(order);
+
+    overlay->valid = true;
+    overlay->generation = g->generation;
+    overlay->level = level;
+
+    printf("Laid out %d names, %d hidden, at zoom level %d in %.2lf ms\n",
+           (int) arrlen(overlay->names), hidden, level, (GetTime() - start) * 1e3);
+}
+
+void draw_name_overlay(Game *g, const Rec *rec)
+{
+    game_update_name_overlay(g);
+
+    const Country *country = session_country(&g->session);
+    Camera2D camera = g->camera;
+
+    for (int i = 0; i < arrlen(g->names.names); ++i) {
+        PlacedName name = g->names.names[i];
+        Vector2 anchor = country->anchors[name.province];
+
+        // the camera does not rotate, so its transform is a scale and two offsets
+        Vector2 world = Vector2Add(rec->ul, Vector2Scale(anchor, DEFAULT_IMAGE_SCALE));
+        Vector2 screen = Vector2Add(Vector2Scale(Vector2Subtract(world, camera.target), camera.zoom), camera.offset);
+
+        text_batch_add(name.text, Vector2Subtract(screen, Vector2Scale(name.text->size, 0.5)), COLOR_PROVINCE_NAMES);
+    }
+}
+
+void learn(Game *g, const Rec *rec)
+{
+    const Country *country = session_country(&g->session);
+    const Layout *layout = &g->layout;
+
+    int screen_width = layout->screen_width;
+    int screen_height = layout->screen_height;
+
+    if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && (GetMouseX() >= layout->countries_panel.width)) {
+        DrawCircleV(GetMousePosition(), 10.0, RED);
+    }
+
+    if (g->show_all_names) draw_name_overlay(g, rec);
+
+    if (g->show_warning_msg) {
+        g->warning_msg_lifetime -= hud_frame_time();
+
+        if (g->warning_msg_lifetime > 0) {
+            const TextLayout *text = text_layout("Click a province", HUD_LARGE_FONTSIZE, TEXT_NO_BOX);
+            Vector2 text_pos = Vector2Subtract(layout->center, Vector2Scale(text->size, 0.5));
+
+            text_batch_add(text, text_pos, RED);
+        } else {
+            g->warning_msg_lifetime = HUD_LIFETIME;
+            g->show_warning_msg = false;
+        }
+    }
+
+    if (g->show_province_name) {
+        g->province_name_lifetime -= hud_frame_time();
+
+        if (g->province_name_lifetime > 0) {
+            const TextLayout *name = text_layout(country->provinces[g->learn_province].value, 40, TEXT_NO_BOX);
+
+            Vector2 center = GetWorldToScreen2D(CLITERAL(Vector2) {
+                g->learn_province_center.x*DEFAULT_IMAGE_SCALE + (screen_width/2 - DEFAULT_IMAGE_SCALE*rec->width/2),
+                g->learn_province_center.y*DEFAULT_IMAGE_SCALE + (screen_height/2 - DEFAULT_IMAGE_SCALE*rec->height/2)
+            }, g->camera);
+
+            Vector2 name_pos = CLITERAL(Vector2) {
+                center.x - name->size.x/2,
+                center.y - name->size.y/2
+            };
+
+            text_batch_add(name, name_pos, RED);
+        } else {
+            g->province_name_lifetime = 3*HUD_LIFETIME;
+            g->show_province_name = false;
+        }
+    }
+}
+
+typedef enum {
+    BS_NONE      = 0, // 00
+    BS_HOVEROVER = 1, // 01
+    BS_CLICKED   = 2, // 10
+} Button_State;
+
+// The mouse is expected in the same coordinates as the boundary
+int button(Rectangle boundary, Vector2 mouse)
+{
+    int hoverover = CheckCollisionPointRec(mouse, boundary);
+    int clicked = 0;
+
+    if (IsMouseButtonReleased(MOUSE_BUTTON_LEFT)) {
+        if (hoverover) clicked = 1;
+    }
+
+    return (clicked << 1) | hoverover;
+}
+
+// Returns true if the layer has to be rendered again; the rendering must then be finished with `panel_layer_end`
+bool panel_layer_begin(PanelLayer *layer, Rectangle boundary, int hovered, ActiveMap active_map, GameState state)
+{
+    int width = (int) boundary.width;
+    int height = (int) boundary.height;
+    if ((width <= 0) || (height <= 0)) return false;
+
+    bool resized = (layer->target.texture.width != width) || (layer->target.texture.height != height);
+    if (!resized && (layer->hovered == hovered) && (layer->active_map == active_map) && (layer->state == state)) {
+        return false;
+    }
+
+    if (resized) {
+        if (layer->target.id > 0) UnloadRenderTexture(layer->target);
+        layer->target = LoadRenderTexture(width, height);
+    }
+
+    layer->hovered = hovered;
+    layer->active_map = active_map;
+    layer->state = state;
+
+    // the layer keeps premultiplied colors with the right coverage in the alpha channel
+    BeginTextureMode(layer->target);
+    ClearBackground(BLANK);
+    rlSetBlendFactorsSeparate(RL_SRC_ALPHA, RL_ONE_MINUS_SRC_ALPHA, RL_ONE, RL_ONE_MINUS_SRC_ALPHA, RL_FUNC_ADD, RL_FUNC_ADD);
+    BeginBlendMode(BLEND_CUSTOM_SEPARATE);
+
+    return true;
+}
+
+void panel_layer_end()
+{
+    text_batch_flush();
+    EndBlendMode();
+    EndTextureMode();
+}
+
+void panel_layer_draw(const PanelLayer *layer, Rectangle boundary)
+{
+    Texture2D texture = layer->target.texture;
+    if (texture.id == 0) return;
+
+    BeginBlendMode(BLEND_ALPHA_PREMULTIPLY);
+    DrawTextureRec(texture,
+            CLITERAL(Rectangle){0, 0, texture.width, -texture.height},
+            CLITERAL(Vector2) {boundary.x, boundary.y},
+            WHITE);
+    EndBlendMode();
+}
+
+/*
+ * The panels handle their buttons every frame, but are rendered into their layers
+ * only when the hovered button, the active map, the mode or the window size changes.
+ * They are laid out relative to their own upper-left corner.
+ */
+void countries_panel(Game *g, Rectangle panel_boundary)
+{
+    const Countries *countries = g->session.countries;
+    Vector2 mouse = Vector2Subtract(GetMousePosition(), CLITERAL(Vector2) {panel_boundary.x, panel_boundary.y});
+
+    //float scroll_bar_width = 0.03 * panel_boundary.width;
+
+    float panel_padding = 0.03 * panel_boundary.width;
+    float entry_size = 80.0;
+
+    Rectangle entries[countries->count];
+    int hovered = -1;
+
+    for (size_t i = 0; i < countries->count; ++i) {
+        entries[i] = CLITERAL(Rectangle) {
+            .x = panel_padding,
+            .y = panel_padding + i * entry_size,
+            .width = panel_boundary.width - panel_padding * 2,
+            .height = entry_size - panel_padding * 2};
+
+        if ((int) i == (int) g->session.active_map) continue;
+
+        int button_state = button(entries[i], mouse);
+        if (button_state & BS_HOVEROVER) hovered = i;
+
+        if (button_state & BS_CLICKED) {
+            game_select_map(g, (ActiveMap) i);
+            hovered = -1;
+        }
+    }
+
+    if (!panel_layer_begin(&g->countries_layer, panel_boundary, hovered, g->session.active_map, g->session.state)) return;
+
+    DrawRectangleRounded(CLITERAL(Rectangle) {0, 0, panel_boundary.width, panel_boundary.height}, 0.1, 4, COLOR_COUNTRIES_PANEL_BACKGROUND);
+
+    for (size_t i = 0; i < countries->count; ++i) {
+        const Country *c = &countries->items[i];
+        Rectangle menu_entry = entries[i];
+
+        Color color;
+        if ((int) i == (int) g->session.active_map) {
+            color = COLOR_PANEL_BUTTON_SELECTED;
+        } else if ((int) i == hovered) {
+            color = COLOR_PANEL_BUTTON_HOVEROVER;
+        } else {
+            color = COLOR_PANEL_BUTTON;
+        }
+
+        DrawRectangleRounded(menu_entry, 0.5, 10, color);
+
+        const TextLayout *name = text_layout(c->display_name, 50,
+                CLITERAL(Vector2) {menu_entry.width, menu_entry.height});
+
+        Vector2 name_pos = CLITERAL(Vector2) {
+            menu_entry.x + menu_entry.width/2 - name->size.x/2,
+            menu_entry.y + menu_entry.height/2 - name->size.y/2
+        };
+
+        text_batch_add(name, name_pos, WHITE);
+    }
+
+    panel_layer_end();
+}
+
+void control_panel(Game *g, Rectangle panel_boundary)
+{
+    Vector2 mouse = Vector2Subtract(GetMousePosition(), CLITERAL(Vector2) {panel_boundary.x, panel_boundary.y});
+
     float panel_padding = 0.02 * panel_boundary.width;
     float entry_size = 85.0;
 
-    Rectangle quiz_button = project_rectangle(CLITERAL(Rectangle) {
-        .x = panel_boundary.x + panel_padding,
-        .y = panel_boundary.y + panel_padding,
-        .width = panel_boundary.width/2 - 2*panel_padding,
-        .height = entry_size - 2*panel_padding,
-    });
-    {
-        int button_state = button(quiz_button);
+    Rectangle quiz_button = CLITERAL(Rectangle) {
+        .x = panel_padding,
+        .y = panel_padding,
+        .width = panel_boundary.width/2 - 2*panel_padding,
+        .height = entry_size - 2*panel_padding,
+    };
+
+    Rectangle learn_button = CLITERAL(Rectangle) {
+       .x = panel_boundary.width/2 + panel_padding,
+       .y = panel_padding,
+       .width = panel_boundary.width/2 - 2*panel_padding,
+       .height = entry_size - 2*panel_padding
+    };
+
+    if ((button(quiz_button, mouse) & BS_CLICKED) && (g->session.state != QUIZ)) {
+        game_restart(g);
+    }
+
+    // only the learn button shows the hover
+    int hovered = -1;
+    if (g->session.state != LEARN) {
+        int button_state = button(learn_button, mouse);
+        if (button_state & BS_HOVEROVER) hovered = 1;
+
+        if (button_state & BS_CLICKED) {
+            game_learn(g);
+            hovered = -1;
+        }
+    }
+
+    GameState state = g->session.state;
+    if (!panel_layer_begin(&g->control_layer, panel_boundary, hovered, g->session.active_map, state)) return;
+
+    DrawRectangleRounded(CLITERAL(Rectangle) {0, 0, panel_boundary.width, panel_boundary.height}, 0.2, 7, COLOR_CONTROL_PANEL_BACKGROUND);
+
+    {
+        Color color;
+        if (state == QUIZ) {
+            color = COLOR_PANEL_BUTTON_SELECTED;
+        } else {
+            color = COLOR_PANEL_BUTTON;
+        }
+
+        DrawRectangleRounded(quiz_button, 0.5, 10, color);
+        const TextLayout *text = text_layout("Quiz", 40, TEXT_NO_BOX);
+
+        Vector2 text_pos = CLITERAL(Vector2) {
+            quiz_button.x + 0.5 * quiz_button.width - 0.5 * text->size.x,
+            quiz_button.y + 0.5 * quiz_button.height - 0.5 * text->size.y
+        };
+
+        text_batch_add(text, text_pos, WHITE);
+    }
+
+    {
+        Color color;
+        if (state == LEARN) {
+            color = COLOR_PANEL_BUTTON_SELECTED;
+        } else if (hovered == 1) {
+            color = COLOR_PANEL_BUTTON_HOVEROVER;
+        } else {
+            color = COLOR_PANEL_BUTTON;
+        }
+
+        DrawRectangleRounded(learn_button, 0.5, 10, color);
+        const TextLayout *text = text_layout("Learn", 40, TEXT_NO_BOX);
+
+        Vector2 text_pos = CLITERAL(Vector2) {
+            learn_button.x + 0.5 * learn_button.width - 0.5 * text->size.x,
+            learn_button.y + 0.5 * learn_button.height - 0.5 * text->size.y
+        };
+
+        text_batch_add(text, text_pos, WHITE);
+    }
+
+    panel_layer_end();
+}
+
+// The pixel of the map under the screen position; returns false if it is off the map
+bool game_map_pixel(const Game *g, Vector2 position, int *imgx, int *imgy)
+{
+    Rec rec = game_map_rec(g);
+    Vector2 world = GetScreenToWorld2D(position, g->camera);
+    *imgx = (int) floorf((world.x - rec.ul.x) / DEFAULT_IMAGE_SCALE);
+    *imgy = (int) floorf((world.y - rec.ul.y) / DEFAULT_IMAGE_SCALE);
+
+    return (*imgx >= 0) && (*imgx < rec.width) && (*imgy >= 0) && (*imgy < rec.height);
+}
+
+// The hover is resolved from the labels, the highlight itself is done by the map shader
+void game_update_hover(Game *g)
+{
+    int imgx, imgy;
+    bool on_map = (g->session.state != VICTORY) &&
+                  (GetMouseX() >= g->layout.countries_panel.width) &&
+                  game_map_pixel(g, GetMousePosition(), &imgx, &imgy);
+    if (!on_map) {
+        g->hovered = -1;
+        g->hover_x = -1;
+        g->hover_y = -1;
+        return;
+    }
+
+#if defined(GPU_PICKING)
+    if (g->gpu_picking) {
+        if ((imgx == g->hover_x) && (imgy == g->hover_y)) return;
+
+        PickRequest request = { .kind = PICK_HOVER, .generation = g->generation, .imgx = imgx, .imgy = imgy };
+        if (gpu_picker_request(&gpu_picker, request)) {
+            g->hover_x = imgx;
+            g->hover_y = imgy;
+        }
+        return;
+    }
+#endif
+
+    g->hovered = country_province_at(session_country(&g->session), imgx, imgy);
+}
+
+// Returns true if the click has a visible effect
+bool game_click_province(Game *g, int province)
+{
+    switch (g->session.state) {
+        case QUIZ:  return quiz_click(g, province);
+        case LEARN: return learn_click(g, province);
+        default:    return false;
+    }
+}
+
+/*
+ * Clicks on the map are handled before the frame is drawn, so their effect is in the
+ * same frame. Returns true if the click has a visible effect. With the GPU picking the
+ * click is only sent to the GPU here and resolved in `game_poll_picks` a frame or two later.
+ */
+bool game_handle_click(Game *g, double frame_start)
+{
+    if (!IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) return false;
+    if (GetMouseX() < g->layout.countries_panel.width) return false;
+    if ((g->session.state != QUIZ) && (g->session.state != LEARN)) return false;
+
+    int imgx, imgy;
+    if (!game_map_pixel(g, GetMousePosition(), &imgx, &imgy)) {
+        printf("Click is outside the image!\n");
+        return false;
+    }
+    printf("Click is inside! imgx = %d; imgy = %d\n", imgx, imgy);
+
+#if defined(GPU_PICKING)
+    if (g->gpu_picking) {
+        PickRequest request = {
+            .kind = PICK_CLICK,
+            .generation = g->generation,
+            .imgx = imgx,
+            .imgy = imgy,
+            .frame_start = frame_start,
+        };
+        if (!gpu_picker_request(&gpu_picker, request)) printf("Click is dropped, all the readbacks are in flight!\n");
+        return false;
+    }
+#else
+    (void) frame_start;
+#endif
+
+    return game_click_province(g, country_province_at(session_country(&g->session), imgx, imgy));
+}
+
+#if defined(GPU_PICKING)
+void game_poll_picks(Game *g)
+{
+    if (!g->gpu_picking) return;
+
+    PickResult results[GPU_PICK_SLOTS];
+    int count = gpu_picker_poll(&gpu_picker, results);
+
+    for (int i = 0; i < count; ++i) {
+        PickRequest request = results[i].request;
+        if (request.generation != g->generation) continue;
+
+        if (request.kind == PICK_HOVER) {
+            // the cursor may have moved on meanwhile
+            if ((request.imgx == g->hover_x) && (request.imgy == g->hover_y)) g->hovered = results[i].province;
+        } else if (game_click_province(g, results[i].province)) {
+            g->latency.pending = request.frame_start;
+        }
+    }
+}
+#endif
+
+/*
+ * The frame is drawn in two passes: the map in world space under the camera, then
+ * the UI in screen space on top of it. The UI does not depend on the camera at all,
+ * so it stays in place and keeps its size while the map is panned and zoomed.
+ */
+void draw_province_map(const Game *g, const Rec *rec)
+{
+    int hovered = g->hovered + 1;
+    Vector4 highlight = ColorNormalize(COLOR_HOVERED_PROVINCE);
+    float province_count = g->palette.width;
+
+    BeginShaderMode(map_shader.shader);
+    SetShaderValueTexture(map_shader.shader, map_shader.labels_loc, g->label_texture);
+    SetShaderValueTexture(map_shader.shader, map_shader.palette_loc, g->palette);
+    SetShaderValue(map_shader.shader, map_shader.province_count_loc, &province_count, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(map_shader.shader, map_shader.hovered_loc, &hovered, SHADER_UNIFORM_INT);
+    SetShaderValue(map_shader.shader, map_shader.highlight_loc, &highlight, SHADER_UNIFORM_VEC4);
+    DrawTextureEx(g->map_texture, rec->ul, 0.0, DEFAULT_IMAGE_SCALE, WHITE);
+    EndShaderMode();
+}
+
+// The raster covers the window under its own camera, which may be behind the current one while zooming
+void draw_view_raster(const Game *g)
+{
+    const ViewRaster *v = &g->view;
+    if (!v->valid) return;
+
+    int hovered = g->hovered + 1;
+    Vector4 highlight = ColorNormalize(COLOR_HOVERED_PROVINCE);
+    float province_count = g->palette.width;
+
+    Vector2 ul = GetScreenToWorld2D(CLITERAL(Vector2) {0, 0}, v->camera);
+    Rectangle world = { ul.x, ul.y, v->width / v->camera.zoom, v->height / v->camera.zoom };
+
+    BeginShaderMode(map_shader.shader);
+    SetShaderValueTexture(map_shader.shader, map_shader.labels_loc, v->label_texture);
+    SetShaderValueTexture(map_shader.shader, map_shader.palette_loc, g->palette);
+    SetShaderValue(map_shader.shader, map_shader.province_count_loc, &province_count, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(map_shader.shader, map_shader.hovered_loc, &hovered, SHADER_UNIFORM_INT);
+    SetShaderValue(map_shader.shader, map_shader.highlight_loc, &highlight, SHADER_UNIFORM_VEC4);
+    DrawTexturePro(v->border_texture, CLITERAL(Rectangle) { 0, 0, v->width, v->height }, world, CLITERAL(Vector2) {0, 0}, 0.0, WHITE);
+    EndShaderMode();
+}
+
+// The whole map in one draw call
+void draw_province_mesh(const Game *g, const Rec *rec)
+{
+    int hovered = g->hovered + 1;
+    Vector4 highlight = ColorNormalize(COLOR_HOVERED_PROVINCE);
+    Vector4 land = ColorNormalize(COLOR_MESH_LAND);
+    float province_count = g->palette.width;
+
+    SetShaderValue(mesh_shader.shader, mesh_shader.province_count_loc, &province_count, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(mesh_shader.shader, mesh_shader.hovered_loc, &hovered, SHADER_UNIFORM_INT);
+    SetShaderValue(mesh_shader.shader, mesh_shader.highlight_loc, &highlight, SHADER_UNIFORM_VEC4);
+    SetShaderValue(mesh_shader.shader, mesh_shader.land_loc, &land, SHADER_UNIFORM_VEC4);
+
+    Material material = g->mesh_material;
+    material.shader = mesh_shader.shader;
+    material.maps[MATERIAL_MAP_DIFFUSE].texture = g->palette;
+
+    Matrix transform = MatrixMultiply(MatrixScale(DEFAULT_IMAGE_SCALE, DEFAULT_IMAGE_SCALE, 1), MatrixTranslate(rec->ul.x, rec->ul.y, 0));
+
+    // the triangles keep the winding of the rings, which is flipped by the y axis going down
+    rlDrawRenderBatchActive();
+    rlDisableBackfaceCulling();
+    DrawMesh(g->meshes[g->session.active_map], material, transform);
+    rlEnableBackfaceCulling();
+}
+
+void draw_frame(Game *g)
+{
+    const Layout *layout = &g->layout;
+
+    ClearBackground(COLOR_BACKGROUND);
+
+    BeginMode2D(g->camera);
+
+    Rec rec = game_map_rec(g);
+    switch (g->render_mode) {
+        case RENDER_MESH: {
+            DrawRectangleV(rec.ul, Vector2Subtract(rec.lr, rec.ul), COLOR_MESH_LAND);
+            draw_province_mesh(g, &rec);
+            break;
+        }
+        case RENDER_VIEW: draw_view_raster(g); break;
+        default:          draw_province_map(g, &rec); break;
+    }
+
+    if (g->show_outlines || (g->render_mode == RENDER_MESH)) {
+        draw_outlines(&session_country(&g->session)->outlines, rec.ul, g->camera.zoom, COLOR_OUTLINE);
+    }
+
+    /*
+       Rectangle map_rectangle = CLITERAL(Rectangle) {
+       .x = PANEL_WIDTH,
+       .y = 0.0,
+       .width = GetScreenWidth() - PANEL_WIDTH,
+       .height = GetScreenHeight()
+       };
+
+       DrawTexturePro(map_texture, CLITERAL(Rectangle) { 0.0f, 0.0f, map_texture.width, map_texture.height },
+       CLITERAL(Rectangle) { GetScreenWidth() / 2.0f, GetScreenHeight() / 2.0f, map_texture.width, map_texture.height },
+       CLITERAL(Vector2) {map_texture.width / 2, map_texture.height / 2}, 0.0f, WHITE);
+       */
+
+    EndMode2D();
+
+    panel_layer_draw(&g->countries_layer, layout->countries_panel);
+    panel_layer_draw(&g->control_layer, layout->control_panel);
+
+    switch (g->session.state) {
+        case QUIZ: {
+                       quiz(g);
+                       break;
+                   }
+
+        case LEARN: {
+                        learn(g, &rec);
+                        break;
+                    }
+
+        case VICTORY: {
+                          victory(g);
+                          break;
+                      }
+
+        default: {
+                     assert(false);
+                 }
+    }
+
+    text_batch_flush();
+}
+
+// Saves the frame rendered into the canvas, the only place where the render texture is needed
+void save_screenshot(RenderTexture2D target)
+{
+    Image image = LoadImageFromTexture(target.texture);
+    ImageFlipVertical(&image);
+
+    const char *filename = TextFormat("screenshot-%ld.png", (long) time(NULL));
+    if (ExportImage(image, filename)) printf("Saved screenshot to %s\n", filename);
+
+    UnloadImage(image);
+}
+
+void update_draw_frame(void *arg)
+{
+    Game *g = (Game*) arg;
+    double frame_start = GetTime();
+
+    if (IsKeyPressed(KEY_R)) {
+        game_restart(g);
+    }
+
+    if (IsKeyPressed(KEY_L)) {
+        game_learn(g);
+    }
+
+    if (IsKeyPressed(KEY_N)) {
+        g->show_all_names = !g->show_all_names;
+    }
+
+    if (IsKeyPressed(KEY_O)) {
+        g->show_outlines = !g->show_outlines;
+    }
+
+    if (IsKeyDown(KEY_S)) {
+        printf("cam.offset.x: %.5lf; cam.offset.y: %.5lf\n", g->camera.offset.x, g->camera.offset.y);
+        printf("cam.target.x: %.5lf; cam.target.y: %.5lf\n", g->camera.target.x, g->camera.target.y);
+        printf("cam.zoom: %.5lf\n", g->camera.zoom);
+    }
+
+    if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
+        Vector2 delta = GetMouseDelta();
+        delta = Vector2Scale(delta, -1.0f / g->camera.zoom);
+
+        //Vector2 new_camera_target = Vector2Add(camera.target, delta);
+        //printf("new_camera_target: %.5lf, %.5lf\n", new_camera_target.x, new_camera_target.y);
+
+        g->camera.target = Vector2Add(g->camera.target, delta);
+        //if (new_camera_target.x > 800.0) camera.target.x = 800.0;
+    }
+
+    float wheel = GetMouseWheelMove();
+
+    if (wheel != 0) {
+        Vector2 mouseWorldPos = GetScreenToWorld2D(GetMousePosition(), g->camera);
+        g->camera.offset = GetMousePosition();
+        g->camera.zoom += wheel * 0.2f;
+        g->camera.target = mouseWorldPos;
+        if (g->camera.zoom < MIN_CAMERA_ZOOM) g->camera.zoom = MIN_CAMERA_ZOOM;
+        if (g->camera.zoom > MAX_CAMERA_ZOOM) g->camera.zoom = MAX_CAMERA_ZOOM;
+    }
+
+    if (layout_update(&g->layout)) {
+        text_cache_clear();
+        g->hud.valid = false;
+        g->names.valid = false;
+    }
+
+    if (g->render_mode == RENDER_VIEW) view_raster_update(g);
+
+    // the layers have to be rendered outside of the frame
+    countries_panel(g, g->layout.countries_panel);
+    control_panel(g, g->layout.control_panel);
+
+#if defined(GPU_PICKING)
+    game_poll_picks(g);
+#endif
+    if (game_handle_click(g, frame_start)) g->latency.pending = frame_start;
+    game_update_hover(g);
+
+    bool screenshot = IsKeyPressed(KEY_F12);
+
+    if (screenshot) {
+        if ((canvas.texture.width != GetScreenWidth()) || (canvas.texture.height != GetScreenHeight())) {
+            if (canvas.id > 0) UnloadRenderTexture(canvas);
+            canvas = LoadRenderTexture(GetScreenWidth(), GetScreenHeight());
+            SetTextureFilter(canvas.texture, TEXTURE_FILTER_POINT);
+        }
+
+        BeginTextureMode(canvas);
+        draw_frame(g);
+        EndTextureMode();
+
+        save_screenshot(canvas);
+
+        BeginDrawing();
+        // flip texture
+        DrawTexturePro(canvas.texture,
+                CLITERAL(Rectangle){0, 0, canvas.texture.width, -canvas.texture.height },
+                CLITERAL(Rectangle){0, 0, GetScreenWidth(), GetScreenHeight()},
+                CLITERAL(Vector2) {0, 0},
+                0, WHITE);
+    } else {
+        BeginDrawing();
+        draw_frame(g);
+    }
+
+    // input and window events wake up `EndDrawing()`, the animations and the picks in flight need every frame,
+    if (g->idle) {
+        bool picking = false;
+#if defined(GPU_PICKING)
+        picking = gpu_picker_busy(&gpu_picker);
+#endif
+        // and so does the view raster waiting for the zoom to settle
+        if (game_is_animating(g) || picking || g->view.pending) {
+            DisableEventWaiting();
+        } else {
+            EnableEventWaiting();
+        }
+    }
+
+    ClickLatency *latency = &g->latency;
+    if (latency->pending >= 0) arrput(latency->submitted, GetTime() - latency->pending);
+
+    EndDrawing();
+
+    if (latency->pending >= 0) {
+        arrput(latency->presented, GetTime() - latency->pending);
+        latency->pending = -1;
+    }
+}
+
+
+/*
+ * Server mode: many headless sessions over a local socket sharing one copy of the countries.
+ *
+ * One connection is one session. Every message is framed as
+ *     u16 payload length | u8 type | payload
+ * with all the integers in little-endian.
+ *
+ *   client -> server
+ *     MSG_SELECT_MAP    u8 map
+ *     MSG_RESTART       -
+ *     MSG_CLICK         u16 imgx, u16 imgy
+ *     MSG_GET_STATE     -
+ *     MSG_SEED          u64 seed; reseeds the session and restarts the quiz
+ *
+ *   server -> client
+ *     MSG_STATE         u8 map, u8 state, i16 hidden province, u32 error counter,
+ *                       u16 province count, u8 status of every province
+ *     MSG_CLICK_RESULT  u8 outcome, u8 state, i16 province, i16 marked province,
+ *                       i16 hidden province, u32 error counter
+ *     MSG_ERROR         u8 type of the rejected message
+ */
+#define SERVER_DEFAULT_PORT 6969
+#define SERVER_MAX_EVENTS 256
+#define MSG_HEADER_SIZE 3
+#define MSG_MAX_SIZE 1024
+
+typedef enum {
+    MSG_SELECT_MAP   = 0x01,
+    MSG_RESTART      = 0x02,
+    MSG_CLICK        = 0x03,
+    MSG_GET_STATE    = 0x04,
+    MSG_SEED         = 0x05,
+
+    MSG_STATE        = 0x81,
+    MSG_CLICK_RESULT = 0x82,
+    MSG_ERROR        = 0xFF,
+} MessageType;
+
+typedef struct {
+    const char *unix_path; // loopback TCP is used if NULL
+    int port;
+} Address;
+
+typedef enum {
+    THINK_FIXED = 0,
+    THINK_UNIFORM,
+    THINK_EXPONENTIAL,
+} ThinkTime;
+
+typedef struct {
+    int count;        // of the connections, the bot mode is off if 0
+    double accuracy;  // probability to click the hidden province
+    ThinkTime think;
+    double think_ms;  // mean think time between the clicks
+    double duration;  // in seconds
+} BotOptions;
+
+typedef struct {
+    uint8_t *items;
+    size_t count;
+    size_t capacity;
+} Bytes;
+
+void put_u8(Bytes *b, uint8_t x)
+{
+    da_append(b, x);
+}
+
+void put_u16(Bytes *b, uint16_t x)
+{
+    da_append(b, x & 0xFF);
+    da_append(b, x >> 8);
+}
+
+void put_u32(Bytes *b, uint32_t x)
+{
+    put_u16(b, x & 0xFFFF);
+    put_u16(b, x >> 16);
+}
+
+void put_u64(Bytes *b, uint64_t x)
+{
+    put_u32(b, x & 0xFFFFFFFF);
+    put_u32(b, x >> 32);
+}
+
+uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | ((uint32_t) get_u16(p + 2) << 16);
+}
+
+uint64_t get_u64(const uint8_t *p)
+{
+    return get_u32(p) | ((uint64_t) get_u32(p + 4) << 32);
+}
+
+// Starts a message in the buffer, returns the offset to be passed to `end_message`
+size_t begin_message(Bytes *b, MessageType type)
+{
+    size_t start = b->count;
+    put_u16(b, 0);
+    put_u8(b, type);
+    return start;
+}
+
+void end_message(Bytes *b, size_t start)
+{
+    size_t payload_size = b->count - start - MSG_HEADER_SIZE;
+    assert(payload_size + MSG_HEADER_SIZE <= MSG_MAX_SIZE);
+    b->items[start + 0] = payload_size & 0xFF;
+    b->items[start + 1] = payload_size >> 8;
+}
+
+#if !defined(PLATFORM_WEB)
+int address_socket(Address address, struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+    memset(addr, 0, sizeof(*addr));
+
+    if (address.unix_path != NULL) {
+        struct sockaddr_un *un = (struct sockaddr_un*) addr;
+        if (strlen(address.unix_path) >= sizeof(un->sun_path)) {
+            fprintf(stderr, "ERROR: socket path `%s` is too long\n", address.unix_path);
+            return -1;
+        }
+
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, address.unix_path);
+        *addr_len = sizeof(*un);
+    } else {
+        struct sockaddr_in *in = (struct sockaddr_in*) addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons(address.port);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        *addr_len = sizeof(*in);
+    }
+
+    int fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) fprintf(stderr, "ERROR: could not create socket: %s\n", strerror(errno));
+
+    return fd;
+}
+
+void socket_set_nodelay(int fd)
+{
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+}
+
+// Thousands of sessions need thousands of file descriptors
+void raise_file_limit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+// The unsent output at which a peer stops being read until it takes its replies. A peer that
+// sends requests without reading them is stalled by the kernel's buffers instead of ours, so the
+// output never grows past this and the largest message.
+#define PEER_HIGH_WATER (16*1024)
+
+// A non-blocking socket with buffered input and output, registered in an epoll instance
+typedef struct {
+    int fd;
+
+    uint8_t in[MSG_MAX_SIZE];
+    size_t in_count;
+
+    Bytes out;
+    size_t out_sent;
+    bool waiting_writable;
+    bool stalled; // over `PEER_HIGH_WATER`, not registered for input
+} Peer;
+
+typedef struct {
+    uint8_t type;
+    const uint8_t *payload;
+    size_t payload_size;
+} Message;
+
+typedef void (*MessageHandler)(void *ctx, Message message);
+
+// Sends as much of the output as possible. Returns false if the peer has to be closed.
+bool peer_flush(int epoll_fd, Peer *peer, void *ptr)
+{
+    while (peer->out_sent < peer->out.count) {
+        ssize_t n = send(peer->fd, peer->out.items + peer->out_sent, peer->out.count - peer->out_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        peer->out_sent += n;
+    }
+
+    // the unsent rest moves to the front, so the buffer is only as large as the output in flight
+    bool pending = peer->out_sent < peer->out.count;
+    if (peer->out_sent > 0) {
+        memmove(peer->out.items, peer->out.items + peer->out_sent, peer->out.count - peer->out_sent);
+        peer->out.count -= peer->out_sent;
+        peer->out_sent = 0;
+    }
+
+    bool stalled = peer->out.count >= PEER_HIGH_WATER;
+    if ((pending != peer->waiting_writable) || (stalled != peer->stalled)) {
+        struct epoll_event event = {
+            .events = (stalled ? 0 : EPOLLIN) | (pending ? EPOLLOUT : 0),
+            .data.ptr = ptr,
+        };
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, peer->fd, &event);
+        peer->waiting_writable = pending;
+        peer->stalled = stalled;
+    }
+
+    return true;
+}
+
+bool peer_has_message(const Peer *peer)
+{
+    return (peer->in_count >= MSG_HEADER_SIZE) && (peer->in_count >= (size_t) get_u16(peer->in) + MSG_HEADER_SIZE);
+}
+
+// Reads everything available and passes every complete message to the handler, until the output
+// reaches `PEER_HIGH_WATER`; the rest waits in the buffer and in the socket for `peer_flush`.
+// Returns false if the peer has to be closed.
+bool peer_read(Peer *peer, MessageHandler handler, void *ctx)
+{
+    for (;;) {
+        size_t offset = 0;
+        while ((peer->out.count - peer->out_sent < PEER_HIGH_WATER) && (peer->in_count - offset >= MSG_HEADER_SIZE)) {
+            const uint8_t *message = peer->in + offset;
+            size_t payload_size = get_u16(message);
+            if (payload_size + MSG_HEADER_SIZE > MSG_MAX_SIZE) return false;
+            if (peer->in_count - offset < payload_size + MSG_HEADER_SIZE) break;
+
+            handler(ctx, CLITERAL(Message) {
+                .type = message[2],
+                .payload = message + MSG_HEADER_SIZE,
+                .payload_size = payload_size,
+            });
+            offset += payload_size + MSG_HEADER_SIZE;
+        }
+
+        memmove(peer->in, peer->in + offset, peer->in_count - offset);
+        peer->in_count -= offset;
+        if (peer->out.count - peer->out_sent >= PEER_HIGH_WATER) return true;
+
+        ssize_t n = recv(peer->fd, peer->in + peer->in_count, sizeof(peer->in) - peer->in_count, 0);
+        if (n == 0) return false;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            return false;
+        }
+        peer->in_count += n;
+    }
+}
+
+void peer_close(int epoll_fd, Peer *peer)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, peer->fd, NULL);
+    close(peer->fd);
+    free(peer->out.items);
+}
+
+typedef struct {
+    int epoll_fd;
+    int listen_fd;
+    bool tcp;
+
+    uint64_t seed;
+    uint64_t accepted; // every session gets its own stream of the seed
+
+    size_t connections;
+    size_t requests;
+    size_t clicks;
+    double click_time_total;
+    double click_time_max;
+} Server;
+
+typedef struct {
+    Peer peer;
+    Server *server;
+    Session session;
+} Connection;
+
+static volatile sig_atomic_t server_quit = 0;
+
+void server_handle_signal(int signum)
+{
+    (void) signum;
+    server_quit = 1;
+}
+
+void send_state(Bytes *out, const Session *s)
+{
+    size_t start = begin_message(out, MSG_STATE);
+    put_u8(out, s->active_map);
+    put_u8(out, s->state);
+    put_u16(out, (uint16_t) s->hidden_province);
+    put_u32(out, s->error_counter);
+    put_u16(out, arrlen(s->statuses));
+    for (int i = 0; i < arrlen(s->statuses); ++i) {
+        put_u8(out, s->statuses[i]);
+    }
+    end_message(out, start);
+}
+
+void send_click_result(Bytes *out, const Session *s, ClickResult result)
+{
+    size_t start = begin_message(out, MSG_CLICK_RESULT);
+    put_u8(out, result.outcome);
+    put_u8(out, s->state);
+    put_u16(out, (uint16_t) result.province);
+    put_u16(out, (uint16_t) result.marked);
+    put_u16(out, (uint16_t) s->hidden_province);
+    put_u32(out, s->error_counter);
+    end_message(out, start);
+}
+
+void send_error(Bytes *out, uint8_t type)
+{
+    size_t start = begin_message(out, MSG_ERROR);
+    put_u8(out, type);
+    end_message(out, start);
+}
+
+void server_handle_message(void *ctx, Message message)
+{
+    Connection *conn = ctx;
+    Server *server = conn->server;
+    Session *s = &conn->session;
+    Bytes *out = &conn->peer.out;
+    const uint8_t *payload = message.payload;
+
+    server->requests += 1;
+
+    switch (message.type) {
+        case MSG_SELECT_MAP: {
+            if ((message.payload_size != 1) || (payload[0] >= s->countries->count)) break;
+            session_select_map(s, (ActiveMap) payload[0]);
+            send_state(out, s);
+            return;
+        }
+
+        case MSG_RESTART: {
+            session_restart(s);
+            send_state(out, s);
+            return;
+        }
+
+        case MSG_CLICK: {
+            if (message.payload_size != 4) break;
+
+            double start = now_seconds();
+            ClickResult result = session_click(s, get_u16(payload), get_u16(payload + 2));
+            double elapsed = now_seconds() - start;
+
+            server->clicks += 1;
+            server->click_time_total += elapsed;
+            if (elapsed > server->click_time_max) server->click_time_max = elapsed;
+
+            send_click_result(out, s, result);
+            return;
+        }
+
+        case MSG_GET_STATE: {
+            send_state(out, s);
+            return;
+        }
+
+        case MSG_SEED: {
+            if (message.payload_size != 8) break;
+            rng_seed(&s->rng, get_u64(payload), 0);
+            session_restart(s);
+            send_state(out, s);
+            return;
+        }
+
+        default: break;
+    }
+
+    send_error(out, message.type);
+}
+
+void server_close_connection(Server *server, Connection *conn)
+{
+    peer_close(server->epoll_fd, &conn->peer);
+    session_free(&conn->session);
+    free(conn);
+
+    server->connections -= 1;
+}
+
+void server_accept(Server *server)
+{
+    for (;;) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "WARNING: could not accept connection: %s\n", strerror(errno));
+            }
+            return;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (server->tcp) socket_set_nodelay(fd);
+
+        Connection *conn = calloc(1, sizeof(*conn));
+        assert(conn != NULL && "Buy more RAM lol");
+        conn->peer.fd = fd;
+        conn->server = server;
+        session_init(&conn->session, &COUNTRIES, MAP_MEXICO, server->seed, server->accepted++);
+
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            fprintf(stderr, "WARNING: could not watch connection: %s\n", strerror(errno));
+            session_free(&conn->session);
+            free(conn);
+            close(fd);
+            continue;
+        }
+
+        server->connections += 1;
+    }
+}
+
+int run_server(Address address, uint64_t seed)
+{
+    raise_file_limit();
+
+    Server server = { .tcp = address.unix_path == NULL, .seed = seed };
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    server.listen_fd = address_socket(address, &addr, &addr_len);
+    if (server.listen_fd < 0) return 1;
+
+    int yes = 1;
+    setsockopt(server.listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (address.unix_path != NULL) unlink(address.unix_path);
+
+    if (bind(server.listen_fd, (struct sockaddr*) &addr, addr_len) < 0 || listen(server.listen_fd, SOMAXCONN) < 0) {
+        fprintf(stderr, "ERROR: could not listen: %s\n", strerror(errno));
+        close(server.listen_fd);
+        return 1;
+    }
+
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event listen_event = { .events = EPOLLIN, .data.ptr = NULL };
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &listen_event);
+
+    signal(SIGINT, server_handle_signal);
+    signal(SIGTERM, server_handle_signal);
+
+    if (address.unix_path != NULL) {
+        printf("Serving quiz sessions on %s\n", address.unix_path);
+    } else {
+        printf("Serving quiz sessions on 127.0.0.1:%d\n", address.port);
+    }
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!server_quit) {
+        int n = epoll_wait(server.epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "ERROR: epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            Connection *conn = events[i].data.ptr;
+            if (conn == NULL) {
+                server_accept(&server);
+                continue;
+            }
 
-        Color color;
-        if (state == QUIZ) {
-            color = COLOR_PANEL_BUTTON_SELECTED;
-        } else {
-            color = COLOR_PANEL_BUTTON;
+            bool alive = true;
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) alive = false;
+            bool readable = events[i].events & EPOLLIN;
+            if (alive && (events[i].events & EPOLLOUT)) alive = peer_flush(server.epoll_fd, &conn->peer, conn);
+            // the requests left in the buffer by a stall wait for no event once the output is taken
+            while (alive && (readable || (!conn->peer.stalled && peer_has_message(&conn->peer)))) {
+                readable = false;
+                alive = peer_read(&conn->peer, server_handle_message, conn);
+                if (alive) alive = peer_flush(server.epoll_fd, &conn->peer, conn);
+            }
+            if (!alive) server_close_connection(&server, conn);
         }
+    }
 
-        if (button_state & BS_CLICKED) {
-            Country *c = reload_country((size_t) active_map);
+    printf("Served %zu requests, %zu clicks", server.requests, server.clicks);
+    if (server.clicks > 0) {
+        printf("; click resolution avg %.3lf us, max %.3lf us",
+               server.click_time_total / server.clicks * 1e6, server.click_time_max * 1e6);
+    }
+    printf("\n");
+
+    close(server.epoll_fd);
+    close(server.listen_fd);
+    if (address.unix_path != NULL) unlink(address.unix_path);
+
+    return 0;
+}
+
+/*
+ * Bot mode: synthetic load for the server. Every bot is one connection playing quizzes on a
+ * random country. It clicks a random pixel of the hidden province with the given accuracy,
+ * a pixel of some other province otherwise, and waits a think time between the clicks.
+ */
+#define BOT_SAMPLES_PER_PROVINCE 32
+#define BOT_LATENCY_BUCKETS 24 // powers of two of microseconds
+
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+} Pixel;
+
+// Pixels of every province of a country for the bots to click on
+typedef struct {
+    Pixel *pixels; // BOT_SAMPLES_PER_PROVINCE per province
+    int *counts;   // how many of them are filled
+} ProvinceSamples;
+
+typedef struct {
+    BotOptions opts;
+    int epoll_fd;
+    ProvinceSamples *samples; // one per country
 
-            UnloadTexture(map_texture);
-            map_texture = LoadTextureFromImage(c->bw_map);
+    double *latencies; // stb_ds array, in seconds
+    size_t histogram[BOT_LATENCY_BUCKETS];
+    size_t correct;
+    size_t restarts;
+    size_t errors;
+} BotRun;
+
+typedef struct {
+    Peer peer;
+    BotRun *run;
+
+    ActiveMap map;
+    int hidden_province;
+    int province_count;
+
+    bool waiting; // for a reply from the server
+    double next_click;
+    double sent_at;
+
+    Rng rng;
+} Bot;
+
+ProvinceSamples sample_provinces(const Country *country, Rng *rng)
+{
+    Province *provinces = country->provinces;
+    int province_count = hmlen(provinces);
+
+    ProvinceSamples samples = {
+        .pixels = calloc(province_count * BOT_SAMPLES_PER_PROVINCE, sizeof(Pixel)),
+        .counts = calloc(province_count, sizeof(int)),
+    };
+    size_t *seen = calloc(province_count, sizeof(size_t));
+
+    // reservoir sampling; neighbouring pixels mostly share the color, so the lookup is cached
+    Image color_map = country->color_map;
+    unsigned int last_hex = 0;
+    int last = (int) hmgeti(provinces, last_hex);
+
+    for (int py = 0; py < color_map.height; ++py) {
+        for (int px = 0; px < color_map.width; ++px) {
+            unsigned int hex = ColorToInt(GetImageColor(color_map, px, py));
+            if (hex != last_hex) {
+                last_hex = hex;
+                last = (int) hmgeti(provinces, hex);
+            }
+            if (last == -1) continue;
 
-            state = QUIZ;
+            size_t j = seen[last]++;
+            if (j >= BOT_SAMPLES_PER_PROVINCE) j = rng_below(rng, seen[last]);
+            if (j < BOT_SAMPLES_PER_PROVINCE) {
+                samples.pixels[last*BOT_SAMPLES_PER_PROVINCE + j] = CLITERAL(Pixel) { px, py };
+                if ((int) j >= samples.counts[last]) samples.counts[last] = j + 1;
+            }
         }
-        
-        DrawRectangleRounded(quiz_button, 0.5, 10, color);
-        float fontsize = 40 / camera.zoom;
-        const char* text = "Quiz";
-        Vector2 text_len = MeasureTextEx(font, text, fontsize, 0);
+    }
 
-        Vector2 text_pos = CLITERAL(Vector2) {
-            quiz_button.x + 0.5 * quiz_button.width - 0.5 * text_len.x, 
-            quiz_button.y + 0.5 * quiz_button.height - 0.5 * text_len.y
-        };
+    free(seen);
+    return samples;
+}
+
+double bot_think_time(Bot *bot)
+{
+    const BotOptions *opts = &bot->run->opts;
+    double mean = opts->think_ms * 1e-3;
 
-        BeginShaderMode(shader);
-        DrawTextEx(font, text, text_pos, fontsize, 0, WHITE);
-        EndShaderMode();
+    switch (opts->think) {
+        case THINK_UNIFORM:     return 2.0 * mean * rng_uniform(&bot->rng);
+        case THINK_EXPONENTIAL: return -mean * log(1.0 - rng_uniform(&bot->rng));
+        default:                return mean;
     }
+}
 
-    Rectangle learn_button = project_rectangle(CLITERAL(Rectangle) {
-       .x = panel_boundary.x + panel_boundary.width/2 + panel_padding,
-       .y = panel_boundary.y + panel_padding,
-       .width = panel_boundary.width/2 - 2*panel_padding, 
-       .height = entry_size - 2*panel_padding 
-    });
-    {
-        int button_state = button(learn_button);
+void bot_send(Bot *bot, MessageType type)
+{
+    end_message(&bot->peer.out, begin_message(&bot->peer.out, type));
+    bot->waiting = true;
+}
 
-        Color color;
-        if (state == LEARN) {
-            color = COLOR_PANEL_BUTTON_SELECTED;
-        } else {
-            if (button_state & BS_HOVEROVER) {
-                color = COLOR_PANEL_BUTTON_HOVEROVER;
-            } else {
-                color = COLOR_PANEL_BUTTON;
-            }
+void bot_click(Bot *bot)
+{
+    const ProvinceSamples *samples = &bot->run->samples[bot->map];
+
+    int target = bot->hidden_province;
+    if ((bot->province_count > 1) && (rng_uniform(&bot->rng) >= bot->run->opts.accuracy)) {
+        do {
+            target = rng_below(&bot->rng, bot->province_count);
+        } while (target == bot->hidden_province);
+    }
+    if (samples->counts[target] == 0) target = bot->hidden_province;
+
+    Pixel pixel = samples->pixels[target*BOT_SAMPLES_PER_PROVINCE + rng_below(&bot->rng, samples->counts[target])];
 
-            if (button_state & BS_CLICKED) {
-                Country *c = reload_country((size_t) active_map);
+    Bytes *out = &bot->peer.out;
+    size_t start = begin_message(out, MSG_CLICK);
+    put_u16(out, pixel.x);
+    put_u16(out, pixel.y);
+    end_message(out, start);
 
-                UnloadTexture(map_texture);
-                map_texture = LoadTextureFromImage(c->bw_map);
+    bot->waiting = true;
+    bot->sent_at = now_seconds();
+}
 
-                state = LEARN;
-            } 
+void bot_handle_message(void *ctx, Message message)
+{
+    Bot *bot = ctx;
+    BotRun *run = bot->run;
+    const uint8_t *payload = message.payload;
+    double now = now_seconds();
+
+    bot->waiting = false;
+    bot->next_click = now + bot_think_time(bot);
+
+    switch (message.type) {
+        case MSG_STATE: {
+            if (message.payload_size < 10) break;
+            bot->map = payload[0];
+            bot->hidden_province = (int16_t) get_u16(payload + 2);
+            bot->province_count = get_u16(payload + 8);
+            return;
         }
 
-        DrawRectangleRounded(learn_button, 0.5, 10, color);
-        float fontsize = 40 / camera.zoom;
-        const char* text = "Learn";
-        Vector2 text_len = MeasureTextEx(font, text, fontsize, 0);
+        case MSG_CLICK_RESULT: {
+            if (message.payload_size != 12) break;
 
-        Vector2 text_pos = CLITERAL(Vector2) {
-            learn_button.x + 0.5 * learn_button.width - 0.5 * text_len.x, 
-            learn_button.y + 0.5 * learn_button.height - 0.5 * text_len.y
-        };
+            double latency = now - bot->sent_at;
+            arrput(run->latencies, latency);
+
+            int bucket = 0;
+            while ((bucket < BOT_LATENCY_BUCKETS - 1) && (latency*1e6 >= (double) (2 << bucket))) bucket++;
+            run->histogram[bucket] += 1;
+
+            if (payload[0] == CLICK_CORRECT) run->correct += 1;
+            bot->hidden_province = (int16_t) get_u16(payload + 6);
+
+            if (payload[1] == VICTORY) {
+                bot_send(bot, MSG_RESTART);
+                run->restarts += 1;
+            }
+            return;
+        }
 
-        BeginShaderMode(shader);
-        DrawTextEx(font, text, text_pos, fontsize, 0, WHITE);
-        EndShaderMode();
+        default: break;
     }
+
+    run->errors += 1;
 }
 
-void update_draw_frame()
+void bot_report(BotRun *run, double elapsed)
 {
-    if (IsKeyDown(KEY_R)) {
-        Country* c = reload_country(active_map);
-        map_texture = LoadTextureFromImage(c->bw_map);
+    size_t clicks = arrlen(run->latencies);
+
+    printf("Bots: %d; duration: %.2lf s; accuracy: %.2lf; think time: %.0lf ms\n",
+           run->opts.count, elapsed, run->opts.accuracy, run->opts.think_ms);
+    printf("Clicks: %zu (%.1lf clicks/s); correct: %zu; restarts: %zu; errors: %zu\n",
+           clicks, clicks / elapsed, run->correct, run->restarts, run->errors);
+    if (clicks == 0) return;
+
+    qsort(run->latencies, clicks, sizeof(double), compare_doubles);
+    printf("Latency: p50 %.1lf us; p90 %.1lf us; p99 %.1lf us; max %.1lf us\n",
+           run->latencies[clicks*50/100] * 1e6,
+           run->latencies[clicks*90/100] * 1e6,
+           run->latencies[clicks*99/100] * 1e6,
+           run->latencies[clicks - 1] * 1e6);
+
+    size_t max_count = 0;
+    for (int i = 0; i < BOT_LATENCY_BUCKETS; ++i) {
+        if (run->histogram[i] > max_count) max_count = run->histogram[i];
+    }
 
-        reset_provinces();
+    for (int i = 0; i < BOT_LATENCY_BUCKETS; ++i) {
+        if (run->histogram[i] == 0) continue;
 
-        hidden_province = select_random_province();
-        error_counter = 0; 
+        int bar = (int) (50 * run->histogram[i] / max_count);
+        printf("  [%8d us, %8d us) %10zu ", i == 0 ? 0 : 1 << i, 2 << i, run->histogram[i]);
+        for (int j = 0; j < bar; ++j) putchar('#');
+        printf("\n");
     }
+}
 
-    if (IsKeyDown(KEY_L)) {
-        Country *country = &COUNTRIES.items[active_map];
-        country->bw_map = LoadImage(country->bw_map_filename);
-        map_texture = LoadTextureFromImage(country->bw_map);
+int run_bots(Address address, BotOptions opts, uint64_t seed)
+{
+    raise_file_limit();
 
-        reset_provinces();
-        error_counter = 0;
-        hidden_province = NULL;
+    BotRun run = { .opts = opts, .epoll_fd = epoll_create1(EPOLL_CLOEXEC) };
 
-        state = LEARN;
+    Rng rng;
+    rng_seed(&rng, seed, 0);
+    run.samples = calloc(COUNTRIES.count, sizeof(ProvinceSamples));
+    for (size_t i = 0; i < COUNTRIES.count; ++i) {
+        run.samples[i] = sample_provinces(&COUNTRIES.items[i], &rng);
     }
 
-    if (IsKeyDown(KEY_S)) {
-        printf("cam.offset.x: %.5lf; cam.offset.y: %.5lf\n", camera.offset.x, camera.offset.y);
-        printf("cam.target.x: %.5lf; cam.target.y: %.5lf\n", camera.target.x, camera.target.y);
-        printf("cam.zoom: %.5lf\n", camera.zoom);
+    Bot *bots = calloc(opts.count, sizeof(Bot));
+    int result = 0;
+    int connected = 0;
+
+    for (; connected < opts.count; ++connected) {
+        Bot *bot = &bots[connected];
+        bot->run = &run;
+        rng_seed(&bot->rng, seed, connected + 1);
+
+        struct sockaddr_storage addr;
+        socklen_t addr_len;
+        int fd = address_socket(address, &addr, &addr_len);
+        if (fd < 0) {
+            result = 1;
+            break;
+        }
+
+        // connecting is blocking to keep it simple, the server is local anyway
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+        if (connect(fd, (struct sockaddr*) &addr, addr_len) < 0) {
+            fprintf(stderr, "ERROR: bot %d could not connect: %s\n", connected, strerror(errno));
+            close(fd);
+            result = 1;
+            break;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if (address.unix_path == NULL) socket_set_nodelay(fd);
+
+        bot->peer.fd = fd;
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = bot };
+        epoll_ctl(run.epoll_fd, EPOLL_CTL_ADD, fd, &event);
+
+        Bytes *out = &bot->peer.out;
+        size_t start = begin_message(out, MSG_SELECT_MAP);
+        put_u8(out, rng_below(&bot->rng, COUNTRIES.count));
+        end_message(out, start);
+        bot->waiting = true;
+        peer_flush(run.epoll_fd, &bot->peer, bot);
     }
 
-    if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT)) {
-        Vector2 delta = GetMouseDelta();
-        delta = Vector2Scale(delta, -1.0f / camera.zoom);
+    signal(SIGINT, server_handle_signal);
+    signal(SIGTERM, server_handle_signal);
 
-        //Vector2 new_camera_target = Vector2Add(camera.target, delta);
-        //printf("new_camera_target: %.5lf, %.5lf\n", new_camera_target.x, new_camera_target.y);
+    double start = now_seconds();
+    double end = start + opts.duration;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+
+    while (result == 0 && !server_quit) {
+        double now = now_seconds();
+        if (now >= end) break;
+
+        double next = end;
+        for (int i = 0; i < connected; ++i) {
+            Bot *bot = &bots[i];
+            if (bot->waiting) continue;
+
+            if (bot->next_click <= now) {
+                bot_click(bot);
+                if (!peer_flush(run.epoll_fd, &bot->peer, bot)) result = 1;
+            } else if (bot->next_click < next) {
+                next = bot->next_click;
+            }
+        }
+
+        int timeout = (int) ceil((next - now) * 1000.0);
+        int n = epoll_wait(run.epoll_fd, events, SERVER_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "ERROR: epoll_wait failed: %s\n", strerror(errno));
+            result = 1;
+        }
 
-        camera.target = Vector2Add(camera.target, delta);
-        //if (new_camera_target.x > 800.0) camera.target.x = 800.0; 
+        for (int i = 0; i < n; ++i) {
+            Bot *bot = events[i].data.ptr;
+
+            bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+            if (alive) alive = peer_read(&bot->peer, bot_handle_message, bot);
+            if (alive) alive = peer_flush(run.epoll_fd, &bot->peer, bot);
+            if (!alive) {
+                fprintf(stderr, "ERROR: the server has closed the connection\n");
+                result = 1;
+            }
+        }
     }
 
-    float wheel = GetMouseWheelMove();
+    if (result == 0) bot_report(&run, now_seconds() - start);
 
-    if (wheel != 0) {
-        Vector2 mouseWorldPos = GetScreenToWorld2D(GetMousePosition(), camera);
-        camera.offset = GetMousePosition();
-        camera.zoom += wheel * 0.2f;
-        camera.target = mouseWorldPos;
-        if (camera.zoom < MIN_CAMERA_ZOOM) camera.zoom = MIN_CAMERA_ZOOM; 
-        if (camera.zoom > MAX_CAMERA_ZOOM) camera.zoom = MAX_CAMERA_ZOOM; 
+    for (int i = 0; i < connected; ++i) {
+        peer_close(run.epoll_fd, &bots[i].peer);
     }
+    free(bots);
 
-    if (IsWindowResized()) {
-        UnloadRenderTexture(canvas);
-        canvas = LoadRenderTexture(GetScreenWidth(), GetScreenHeight());
+    for (size_t i = 0; i < COUNTRIES.count; ++i) {
+        free(run.samples[i].pixels);
+        free(run.samples[i].counts);
     }
+    free(run.samples);
+    arrfree(run.latencies);
+    close(run.epoll_fd);
 
-    BeginTextureMode(canvas); 
-    BeginMode2D(camera);
+    return result;
+}
+#endif // PLATFORM_WEB
+
+#if !defined(PLATFORM_WEB)
+/*
+ * Import of a country from GeoJSON. The features of a FeatureCollection with the Polygon and
+ * the MultiPolygon geometries become the provinces, named by the first of `IMPORT_NAME_KEYS` in
+ * their properties. The coordinates are projected with Mercator and fitted to the requested width,
+ * then the provinces are rasterized into the label map by `rasterize_edges`. The result goes
+ * where `load_country` expects a country: the colored map, the black-white map with the borders
+ * and the coast, and the province table read by `fill_provinces`. The maps already in resources/
+ * are only overwritten with `--force`, and a new country is found by `load_imported_countries`.
+ */
+#define IMPORT_DEFAULT_WIDTH 4096
+#define IMPORT_MARGIN 0.02 // of the width on every side
+
+static const char *IMPORT_NAME_KEYS[] = { "name", "NAME_1", "shapeName", "NAME", "name_en" };
 
-    ClearBackground(COLOR_BACKGROUND);
+typedef enum {
+    JSON_NULL = 0,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+} JsonType;
+
+// A flat token of the parsed text; the members of an object are the key and the value tokens in turn
+typedef struct {
+    JsonType type;
+    int start; // in the text, a string without the quotes
+    int end;
+    int count; // of the items of an array or of the members of an object
+    int next;  // the token after this value with everything in it
+} JsonToken;
 
-    float posx = GetScreenWidth()/2 - DEFAULT_IMAGE_SCALE * map_texture.width/2;
-    float posy = GetScreenHeight()/2 - DEFAULT_IMAGE_SCALE * map_texture.height/2;
-    DrawTextureEx(map_texture, CLITERAL(Vector2){posx, posy}, 0.0, DEFAULT_IMAGE_SCALE, WHITE);
+typedef struct {
+    const char *text;
+    int size;
+    int pos;
+    JsonToken *tokens; // stb_ds array
+} JsonParser;
 
-    /*
-       Rectangle map_rectangle = CLITERAL(Rectangle) {
-       .x = PANEL_WIDTH, 
-       .y = 0.0, 
-       .width = GetScreenWidth() - PANEL_WIDTH,
-       .height = GetScreenHeight()
-       };
+void json_skip_whitespace(JsonParser *p)
+{
+    while ((p->pos < p->size) && isspace((unsigned char) p->text[p->pos])) p->pos += 1;
+}
 
-       DrawTexturePro(map_texture, CLITERAL(Rectangle) { 0.0f, 0.0f, map_texture.width, map_texture.height }, 
-       CLITERAL(Rectangle) { GetScreenWidth() / 2.0f, GetScreenHeight() / 2.0f, map_texture.width, map_texture.height }, 
-       CLITERAL(Vector2) {map_texture.width / 2, map_texture.height / 2}, 0.0f, WHITE);
-       */
+// Returns false on a syntax error
+bool json_parse_value(JsonParser *p)
+{
+    json_skip_whitespace(p);
+    if (p->pos >= p->size) return false;
+
+    int index = arrlen(p->tokens);
+    JsonToken token = { .start = p->pos };
+    arrput(p->tokens, token);
+
+    char c = p->text[p->pos];
+    if ((c == '{') || (c == '[')) {
+        token.type = (c == '{') ? JSON_OBJECT : JSON_ARRAY;
+        char close = (c == '{') ? '}' : ']';
+        p->pos += 1;
+
+        json_skip_whitespace(p);
+        if ((p->pos < p->size) && (p->text[p->pos] == close)) {
+            p->pos += 1;
+        } else {
+            for (;;) {
+                if (token.type == JSON_OBJECT) {
+                    json_skip_whitespace(p);
+                    if ((p->pos >= p->size) || (p->text[p->pos] != '"') || !json_parse_value(p)) return false;
+                    json_skip_whitespace(p);
+                    if ((p->pos >= p->size) || (p->text[p->pos] != ':')) return false;
+                    p->pos += 1;
+                }
+                if (!json_parse_value(p)) return false;
+                token.count += 1;
+
+                json_skip_whitespace(p);
+                if (p->pos >= p->size) return false;
+                if (p->text[p->pos] == close) break;
+                if (p->text[p->pos] != ',') return false;
+                p->pos += 1;
+            }
+            p->pos += 1;
+        }
+    } else if (c == '"') {
+        token.type = JSON_STRING;
+        token.start = ++p->pos;
+        while ((p->pos < p->size) && (p->text[p->pos] != '"')) {
+            p->pos += (p->text[p->pos] == '\\') ? 2 : 1;
+        }
+        if (p->pos >= p->size) return false;
+        token.end = p->pos++;
+    } else {
+        // a number or a literal, told apart by the first character
+        while ((p->pos < p->size) && (strchr(",]} \t\r\n", p->text[p->pos]) == NULL)) p->pos += 1;
+        token.type = (c == 'n') ? JSON_NULL : ((c == 't') || (c == 'f')) ? JSON_BOOL : JSON_NUMBER;
+    }
 
-    countries_panel(CLITERAL(Rectangle) {
-            .x = 0, 
-            .y = 0,
-            .width = COUNTRIES_PANEL_WIDTH * GetScreenWidth(),
-            .height = COUNTRIES_PANEL_HEIGHT * GetScreenHeight()
-            }, &hidden_province); 
-
-    float padding = 0.01;
-    control_panel(CLITERAL(Rectangle) {
-            .x = 0,
-            .y = (COUNTRIES_PANEL_HEIGHT + padding) * GetScreenHeight(),
-            .width = COUNTRIES_PANEL_WIDTH * GetScreenWidth(),
-            .height = (1.0 - COUNTRIES_PANEL_HEIGHT - 2*padding) * GetScreenHeight()
-            }); 
-
-    Rec rec = (Rec) {
-        .ul = CLITERAL(Vector2) {posx, posy},
-            .lr = CLITERAL(Vector2) { 
-                posx + DEFAULT_IMAGE_SCALE * map_texture.width,
-                posy + DEFAULT_IMAGE_SCALE * map_texture.height
-            },
-            .width = map_texture.width,
-            .height = map_texture.height
-    }; 
+    if (token.type != JSON_STRING) token.end = p->pos;
+    token.next = arrlen(p->tokens);
+    p->tokens[index] = token;
+    return true;
+}
 
-    switch (state) {
-        case QUIZ: {
-                       quiz(&rec, &hidden_province);
-                       break;
-                   }
+// Returns the token of the value of the key in the object or -1 if there is none
+int json_get(const JsonParser *p, int object, const char *key)
+{
+    if ((object < 0) || (p->tokens[object].type != JSON_OBJECT)) return -1;
+
+    int length = strlen(key);
+    int t = object + 1;
+    for (int i = 0; i < p->tokens[object].count; ++i) {
+        const JsonToken *k = &p->tokens[t];
+        if ((k->end - k->start == length) && (memcmp(p->text + k->start, key, length) == 0)) return t + 1;
+        t = p->tokens[t + 1].next;
+    }
+    return -1;
+}
 
-        case LEARN: {
-                        learn(&rec); 
-                        break;
-                    }
+bool json_string_equals(const JsonParser *p, int t, const char *s)
+{
+    return (t >= 0) && (p->tokens[t].type == JSON_STRING) && ((int) strlen(s) == p->tokens[t].end - p->tokens[t].start) &&
+           (memcmp(p->text + p->tokens[t].start, s, strlen(s)) == 0);
+}
 
-        case VICTORY: {
-                          victory();
-                          break;
-                      }
+double json_number(const JsonParser *p, int t)
+{
+    return strtod(p->text + p->tokens[t].start, NULL);
+}
 
-        default: {
-                     assert(false);
-                 }
+// Decodes the escapes, \u to UTF-8; the string is malloc-ed
+char *json_string(const JsonParser *p, int t)
+{
+    const char *s = p->text + p->tokens[t].start;
+    int length = p->tokens[t].end - p->tokens[t].start;
+    char *result = malloc(length + 1);
+    assert(result != NULL && "Buy more RAM lol");
+
+    int n = 0;
+    for (int i = 0; i < length; ++i) {
+        if ((s[i] != '\\') || (i + 1 >= length)) {
+            result[n++] = s[i];
+            continue;
+        }
+
+        char e = s[++i];
+        switch (e) {
+            case 'n': result[n++] = '\n'; break;
+            case 't': result[n++] = '\t'; break;
+            case 'r': result[n++] = '\r'; break;
+            case 'b': result[n++] = '\b'; break;
+            case 'f': result[n++] = '\f'; break;
+            case 'u': {
+                if (i + 4 >= length) break;
+                char hex[5] = { s[i + 1], s[i + 2], s[i + 3], s[i + 4], 0 };
+                i += 4;
+                int size = 0;
+                const char *utf8 = CodepointToUTF8(strtol(hex, NULL, 16), &size);
+                memcpy(result + n, utf8, size); // never longer than the escape
+                n += size;
+                break;
+            }
+            default: result[n++] = e;
+        }
     }
+    result[n] = '\0';
+    return result;
+}
 
-    EndMode2D();
-    EndTextureMode();
+typedef struct {
+    double x;
+    double y;
+} GeoPoint;
 
-    BeginDrawing();
-    // flip texture 
-    DrawTexturePro(canvas.texture,
-            CLITERAL(Rectangle){0, 0, canvas.texture.width, -canvas.texture.height },
-            CLITERAL(Rectangle){0, 0, GetScreenWidth(), GetScreenHeight()}, 
-            CLITERAL(Vector2) {0, 0},
-            0, WHITE);
+typedef struct {
+    int start; // in the points
+    int count;
+} GeoRing;
 
-    EndDrawing();
+typedef struct {
+    char *name;
+    int ring_start; // in the rings, up to the `ring_start` of the next one
+} GeoProvince;
+
+typedef struct {
+    GeoProvince *provinces; // stb_ds arrays
+    GeoRing *rings;
+    GeoPoint *points;
+} GeoCountry;
+
+// The rings of a Polygon; the GeoJSON rings repeat the first point at the end, which is left out
+bool geo_add_polygon(GeoCountry *geo, const JsonParser *p, int polygon)
+{
+    if (p->tokens[polygon].type != JSON_ARRAY) return false;
+
+    // the items of an array follow each other by `next`
+    int ring = polygon + 1;
+    for (int r = 0; r < p->tokens[polygon].count; ++r, ring = p->tokens[ring].next) {
+        if (p->tokens[ring].type != JSON_ARRAY) return false;
+
+        GeoRing geo_ring = { .start = arrlen(geo->points) };
+        int point = ring + 1;
+        for (int k = 0; k < p->tokens[ring].count; ++k, point = p->tokens[point].next) {
+            if ((p->tokens[point].type != JSON_ARRAY) || (p->tokens[point].count < 2)) return false;
+
+            // longitude and latitude in degrees, mapped with Mercator
+            int x = point + 1;
+            int y = p->tokens[x].next;
+            if ((p->tokens[x].type != JSON_NUMBER) || (p->tokens[y].type != JSON_NUMBER)) return false;
+            double lon = json_number(p, x);
+            double lat = Clamp(json_number(p, y), -85, 85);
+            GeoPoint projected = { lon * DEG2RAD, -log(tan(PI/4 + lat * DEG2RAD / 2)) };
+            arrput(geo->points, projected);
+        }
+
+        geo_ring.count = arrlen(geo->points) - geo_ring.start;
+        GeoPoint first = geo->points[geo_ring.start];
+        GeoPoint last = geo->points[arrlen(geo->points) - 1];
+        if ((geo_ring.count > 1) && (first.x == last.x) && (first.y == last.y)) {
+            arrsetlen(geo->points, arrlen(geo->points) - 1);
+            geo_ring.count -= 1;
+        }
+        if (geo_ring.count >= 3) arrput(geo->rings, geo_ring);
+    }
+
+    return true;
+}
+
+bool geo_load(GeoCountry *geo, const char *path)
+{
+    int size = 0;
+    unsigned char *data = LoadFileData(path, &size);
+    if (data == NULL) return false;
+
+    JsonParser p = { .text = (const char*) data, .size = size };
+    bool ok = json_parse_value(&p);
+    if (!ok) fprintf(stderr, "ERROR: %s is not valid JSON at byte %d\n", path, p.pos);
+
+    int features = ok ? json_get(&p, 0, "features") : -1;
+    if (ok && ((features < 0) || (p.tokens[features].type != JSON_ARRAY))) {
+        fprintf(stderr, "ERROR: %s is not a GeoJSON FeatureCollection\n", path);
+        ok = false;
+    }
+
+    int feature = features + 1;
+    for (int f = 0; ok && (f < p.tokens[features].count); ++f, feature = p.tokens[feature].next) {
+        int geometry = json_get(&p, feature, "geometry");
+        int coordinates = json_get(&p, geometry, "coordinates");
+        int type = json_get(&p, geometry, "type");
+        if (coordinates < 0) continue;
+
+        GeoProvince province = { .ring_start = arrlen(geo->rings) };
+        if (json_string_equals(&p, type, "Polygon")) {
+            ok = geo_add_polygon(geo, &p, coordinates);
+        } else if (json_string_equals(&p, type, "MultiPolygon")) {
+            int polygon = coordinates + 1;
+            for (int k = 0; ok && (k < p.tokens[coordinates].count); ++k, polygon = p.tokens[polygon].next) {
+                ok = geo_add_polygon(geo, &p, polygon);
+            }
+        } else {
+            continue;
+        }
+        if (!ok) {
+            fprintf(stderr, "ERROR: malformed coordinates of the feature %d in %s\n", f, path);
+            break;
+        }
+
+        int properties = json_get(&p, feature, "properties");
+        for (size_t k = 0; (province.name == NULL) && (k < sizeof(IMPORT_NAME_KEYS) / sizeof(IMPORT_NAME_KEYS[0])); ++k) {
+            int name = json_get(&p, properties, IMPORT_NAME_KEYS[k]);
+            if ((name >= 0) && (p.tokens[name].type == JSON_STRING)) province.name = json_string(&p, name);
+        }
+        if (province.name == NULL) province.name = strdup(TextFormat("Province %d", (int) arrlen(geo->provinces) + 1));
+
+        arrput(geo->provinces, province);
+    }
+
+    arrfree(p.tokens);
+    UnloadFileData(data);
+    return ok;
+}
+
+void geo_free(GeoCountry *geo)
+{
+    for (int i = 0; i < arrlen(geo->provinces); ++i) {
+        free(geo->provinces[i].name);
+    }
+    arrfree(geo->provinces);
+    arrfree(geo->rings);
+    arrfree(geo->points);
+}
+
+// Returns the labels, province index + 1 of every pixel or 0; the height follows from the aspect of the country
+uint16_t *rasterize_country(const GeoCountry *geo, int width, int *height)
+{
+    double start = now_seconds();
+
+    double min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+    for (int i = 0; i < arrlen(geo->points); ++i) {
+        min_x = fmin(min_x, geo->points[i].x);
+        min_y = fmin(min_y, geo->points[i].y);
+        max_x = fmax(max_x, geo->points[i].x);
+        max_y = fmax(max_y, geo->points[i].y);
+    }
+
+    double margin = IMPORT_MARGIN * width;
+    double scale = (width - 2*margin) / fmax(max_x - min_x, 1e-9);
+    *height = (int) ceil((max_y - min_y) * scale + 2*margin);
+
+    RasterEdge *edges = NULL;
+    for (int i = 0; i < arrlen(geo->provinces); ++i) {
+        int ring_end = (i + 1 < arrlen(geo->provinces)) ? geo->provinces[i + 1].ring_start : arrlen(geo->rings);
+        for (int r = geo->provinces[i].ring_start; r < ring_end; ++r) {
+            GeoRing ring = geo->rings[r];
+            for (int k = 0; k < ring.count; ++k) {
+                GeoPoint a = geo->points[ring.start + k];
+                GeoPoint b = geo->points[ring.start + (k + 1) % ring.count];
+                raster_add_edge(&edges,
+                                CLITERAL(Vector2) { (a.x - min_x) * scale + margin, (a.y - min_y) * scale + margin },
+                                CLITERAL(Vector2) { (b.x - min_x) * scale + margin, (b.y - min_y) * scale + margin },
+                                i + 1);
+            }
+        }
+    }
+
+    uint16_t *labels = calloc((size_t) width * *height, sizeof(uint16_t));
+    assert(labels != NULL && "Buy more RAM lol");
+    int thread_count = rasterize_edges(edges, arrlen(edges), labels, width, 0, 0, width, *height);
+
+    printf("Rasterized %d provinces of %d edges into %dx%d on %d threads in %.2lf ms\n",
+           (int) arrlen(geo->provinces), (int) arrlen(edges), width, *height, thread_count, (now_seconds() - start) * 1e3);
+
+    arrfree(edges);
+    return labels;
+}
+
+// Distinct saturated colors, apart from black and white taken by the borders and the sea
+Color import_province_color(int i)
+{
+    float hue = fmodf(i * 137.50776f, 360.0f);
+    float saturation = 0.9f - 0.3f * ((i / 7) % 2);
+    float value = 0.95f - 0.25f * ((i / 3) % 3) / 2.0f;
+    return ColorFromHSV(hue, saturation, value);
 }
 
+// With `force` the maps of a country already in resources/ are overwritten
+int import_country(const char *path, int width, bool force)
+{
+    char name[256] = {0}; // raylib keeps its results in static buffers, which the paths below reuse
+    strncpy(name, TextToLower(GetFileNameWithoutExt(path)), sizeof(name) - 1);
+
+    const char *outputs[] = { "colored.png", "black-white.png", "provinces.txt" };
+    for (size_t i = 0; !force && (i < sizeof(outputs) / sizeof(outputs[0])); ++i) {
+        const char *output = TextFormat("resources/%s-%s", name, outputs[i]);
+        if (FileExists(output)) {
+            fprintf(stderr, "ERROR: %s is already there, --force overwrites it\n", output);
+            return 1;
+        }
+    }
+
+    GeoCountry geo = {0};
+    if (!geo_load(&geo, path)) {
+        geo_free(&geo);
+        return 1;
+    }
+    if ((arrlen(geo.provinces) == 0) || (arrlen(geo.provinces) >= LABEL_SNAPPED)) {
+        fprintf(stderr, "ERROR: %s has %d provinces\n", path, (int) arrlen(geo.provinces));
+        geo_free(&geo);
+        return 1;
+    }
+
+    int height = 0;
+    uint16_t *labels = rasterize_country(&geo, width, &height);
+    int province_count = arrlen(geo.provinces);
+
+    Color *colors = malloc(province_count * sizeof(Color));
+    assert(colors != NULL && "Buy more RAM lol");
+    for (int i = 0, seed = 0; i < province_count; ++i, ++seed) {
+        colors[i] = import_province_color(seed);
+        for (int j = 0; j < i; ++j) {
+            if (ColorToInt(colors[j]) == ColorToInt(colors[i])) {
+                i -= 1; // taken, the next one
+                break;
+            }
+        }
+    }
+
+    // a pixel differing from the one to the right or below is on a border or the coast,
+    // black in the colored map like the hand-painted ones and white in the black-white one
+    Image colored = { .width = width, .height = height, .mipmaps = 1, .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8 };
+    Image bw = { .width = width, .height = height, .mipmaps = 1, .format = PIXELFORMAT_UNCOMPRESSED_GRAYSCALE };
+    colored.data = calloc((size_t) width * height, 3);
+    bw.data = calloc((size_t) width * height, 1);
+    assert(colored.data != NULL && bw.data != NULL && "Buy more RAM lol");
+
+    unsigned char *colored_pixels = colored.data;
+    unsigned char *bw_pixels = bw.data;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            size_t i = (size_t) y * width + x;
+            uint16_t label = labels[i];
+            bool border = ((x + 1 < width) && (labels[i + 1] != label)) || ((y + 1 < height) && (labels[i + width] != label));
+
+            if (border) {
+                bw_pixels[i] = 255;
+            } else if (label > 0) {
+                Color color = colors[label - 1];
+                colored_pixels[3*i + 0] = color.r;
+                colored_pixels[3*i + 1] = color.g;
+                colored_pixels[3*i + 2] = color.b;
+            }
+        }
+    }
+
+    char *table = NULL;
+    for (int i = 0; i < province_count; ++i) {
+        const char *line = TextFormat("%06x\t%s\n", (unsigned int) ColorToInt(colors[i]) >> 8, geo.provinces[i].name);
+        memcpy(arraddnptr(table, strlen(line)), line, strlen(line));
+    }
+
+    double start = now_seconds();
+    bool ok = ExportImage(colored, TextFormat("resources/%s-colored.png", name)) &&
+              ExportImage(bw, TextFormat("resources/%s-black-white.png", name)) &&
+              SaveFileData(TextFormat("resources/%s-provinces.txt", name), table, arrlen(table));
+    if (ok) printf("Saved %d provinces of %s as resources/%s-* in %.2lf s\n", province_count, path, name, now_seconds() - start);
+
+    arrfree(table);
+    UnloadImage(bw);
+    UnloadImage(colored);
+    free(colors);
+    free(labels);
+    geo_free(&geo);
+    return ok ? 0 : 1;
+}
+#endif // PLATFORM_WEB
+
+typedef struct {
+    uint64_t seed;
+    bool idle;
+    bool low_latency;
+    bool gpu_picking;
+    RenderMode render_mode;
+    int snap_radius;
+    bool cook;
+    const char *import;
+    int import_width;
+    bool force;
+    bool server;
+    BotOptions bot;
+    Address address;
+} Options;
+
+void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [OPTIONS]\n", program);
+    fprintf(stderr, "    --seed <n>        seed of the random province selection (default: current time)\n");
+    fprintf(stderr, "    --idle            redraw only on input, window events and running animations\n");
+    fprintf(stderr, "    --low-latency     pace the frames by vsync instead of sleeping to 60 FPS\n");
+    fprintf(stderr, "    --gpu-picking     read the provinces back from the GPU and drop their CPU copies\n");
+    fprintf(stderr, "    --mesh            draw the provinces as triangles traced from the maps instead of the map textures\n");
+    fprintf(stderr, "    --view-raster     rasterize the provinces at the resolution of the window instead of the map textures\n");
+    fprintf(stderr, "    --snap-radius <px> resolve a click on a border to the nearest province within the radius (default: %d)\n", SNAP_DEFAULT_RADIUS);
+    fprintf(stderr, "    --cook            trace the province outlines of all the countries into the cache and exit\n");
+    fprintf(stderr, "    --import <path>   rasterize the provinces of a GeoJSON file into the maps of a country in resources/ and exit\n");
+    fprintf(stderr, "    --import-width <px> width of the imported maps (default: %d)\n", IMPORT_DEFAULT_WIDTH);
+    fprintf(stderr, "    --force           let --import overwrite the maps of a country that are already in resources/\n");
+    fprintf(stderr, "    --server          serve headless quiz sessions instead of opening a window\n");
+    fprintf(stderr, "    --port <port>     loopback TCP port of the server (default: %d)\n", SERVER_DEFAULT_PORT);
+    fprintf(stderr, "    --unix <path>     serve on a Unix domain socket instead of TCP\n");
+    fprintf(stderr, "    --bot <n>         load the server with n bot connections and report the latencies\n");
+    fprintf(stderr, "    --accuracy <p>    probability of a bot to click the right province (default: 0.7)\n");
+    fprintf(stderr, "    --think <dist>    distribution of the bot think time: fixed, uniform or exp (default: exp)\n");
+    fprintf(stderr, "    --think-ms <ms>   mean bot think time (default: 500)\n");
+    fprintf(stderr, "    --duration <s>    duration of the bot run (default: 10)\n");
+}
+
+bool parse_options(Options *opts, int argc, char **argv)
+{
+    *opts = (Options) {
+        .seed = (uint64_t) time(NULL),
+        .snap_radius = SNAP_DEFAULT_RADIUS,
+        .import_width = IMPORT_DEFAULT_WIDTH,
+        .address.port = SERVER_DEFAULT_PORT,
+        .bot = {
+            .accuracy = 0.7,
+            .think = THINK_EXPONENTIAL,
+            .think_ms = 500.0,
+            .duration = 10.0,
+        },
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        const char *arg = argv[i];
+
+        if ((strcmp(arg, "--seed") == 0) && (i + 1 < argc)) {
+            opts->seed = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(arg, "--idle") == 0) {
+            opts->idle = true;
+        } else if (strcmp(arg, "--low-latency") == 0) {
+            opts->low_latency = true;
+        } else if (strcmp(arg, "--gpu-picking") == 0) {
+            opts->gpu_picking = true;
+        } else if (strcmp(arg, "--mesh") == 0) {
+            opts->render_mode = RENDER_MESH;
+        } else if (strcmp(arg, "--view-raster") == 0) {
+            opts->render_mode = RENDER_VIEW;
+        } else if ((strcmp(arg, "--snap-radius") == 0) && (i + 1 < argc)) {
+            opts->snap_radius = atoi(argv[++i]);
+        } else if (strcmp(arg, "--cook") == 0) {
+            opts->cook = true;
+        } else if ((strcmp(arg, "--import") == 0) && (i + 1 < argc)) {
+            opts->import = argv[++i];
+        } else if ((strcmp(arg, "--import-width") == 0) && (i + 1 < argc)) {
+            opts->import_width = atoi(argv[++i]);
+        } else if (strcmp(arg, "--force") == 0) {
+            opts->force = true;
+        } else if (strcmp(arg, "--server") == 0) {
+            opts->server = true;
+        } else if ((strcmp(arg, "--port") == 0) && (i + 1 < argc)) {
+            opts->address.port = atoi(argv[++i]);
+        } else if ((strcmp(arg, "--unix") == 0) && (i + 1 < argc)) {
+            opts->address.unix_path = argv[++i];
+        } else if ((strcmp(arg, "--bot") == 0) && (i + 1 < argc)) {
+            opts->bot.count = atoi(argv[++i]);
+        } else if ((strcmp(arg, "--accuracy") == 0) && (i + 1 < argc)) {
+            opts->bot.accuracy = atof(argv[++i]);
+        } else if ((strcmp(arg, "--think") == 0) && (i + 1 < argc)) {
+            const char *dist = argv[++i];
+            if (strcmp(dist, "fixed") == 0) {
+                opts->bot.think = THINK_FIXED;
+            } else if (strcmp(dist, "uniform") == 0) {
+                opts->bot.think = THINK_UNIFORM;
+            } else if (strcmp(dist, "exp") == 0) {
+                opts->bot.think = THINK_EXPONENTIAL;
+            } else {
+                fprintf(stderr, "ERROR: unknown think time distribution `%s`\n", dist);
+                return false;
+            }
+        } else if ((strcmp(arg, "--think-ms") == 0) && (i + 1 < argc)) {
+            opts->bot.think_ms = atof(argv[++i]);
+        } else if ((strcmp(arg, "--duration") == 0) && (i + 1 < argc)) {
+            opts->bot.duration = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "ERROR: unknown option `%s`\n", arg);
+            return false;
+        }
+    }
+
+    if ((opts->render_mode != RENDER_MAP) && opts->gpu_picking) {
+        fprintf(stderr, "ERROR: --gpu-picking reads the label textures, which are not there with --mesh or --view-raster\n");
+        return false;
+    }
+
+    return true;
+}
 
-int main()
+int main(int argc, char **argv)
 {
-    srand(time(NULL));
+    Options opts;
+    if (!parse_options(&opts, argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+#if !defined(PLATFORM_WEB)
+    if (opts.import != NULL) return import_country(opts.import, opts.import_width, opts.force);
+#endif
+
     stbds_rand_seed(time(NULL));
+    printf("Seed: %llu\n", (unsigned long long) opts.seed);
+
+    load_country("Mexico", "Mexico", opts.snap_radius);
+    load_country("Brazil", "Brazil", opts.snap_radius);
+    load_country("Japan", "Japan", opts.snap_radius);
+    load_country("Phillipines-islands", "Phillipines\nIslands", opts.snap_radius);
+    load_country("Malaysia", "Malaysia", opts.snap_radius);
+    load_imported_countries(opts.snap_radius);
+
+#if !defined(PLATFORM_WEB)
+    if (opts.server || (opts.bot.count > 0)) {
+        int result = opts.server ? run_server(opts.address, opts.seed) : run_bots(opts.address, opts.bot, opts.seed);
+
+        for (size_t i = 0; i < COUNTRIES.count; ++i) {
+            unload_country(&COUNTRIES.items[i]);
+        }
+        free(COUNTRIES.items);
+
+        return result;
+    }
+
+    if (opts.cook) {
+        for (size_t i = 0; i < COUNTRIES.count; ++i) {
+            load_country_outlines(&COUNTRIES.items[i], true);
+            unload_country(&COUNTRIES.items[i]);
+        }
+        free(COUNTRIES.items);
+
+        return 0;
+    }
+#endif
 
-    load_country("Mexico", "Mexico");
-    load_country("Brazil", "Brazil");
-    load_country("Japan", "Japan");
-    load_country("Phillipines-islands", "Phillipines\nIslands");
-    load_country("Malaysia", "Malaysia");
+    for (size_t i = 0; i < COUNTRIES.count; ++i) {
+        load_country_outlines(&COUNTRIES.items[i], false);
+        // the clicks on the view raster go through the triangle grid of the mesh as well
+        if (opts.render_mode != RENDER_MAP) {
+            triangulate_country(&COUNTRIES.items[i]);
+            index_province_mesh(&COUNTRIES.items[i]);
+            country_free_labels(&COUNTRIES.items[i]);
+
+            // nor is the map image drawn
+            UnloadImage(COUNTRIES.items[i].bw_map);
+            COUNTRIES.items[i].bw_map.data = NULL;
+        }
+    }
 
     SetConfigFlags(FLAG_WINDOW_RESIZABLE);
     SetConfigFlags(FLAG_MSAA_4X_HINT);
-    camera.zoom = 1.0; 
-    
+    if (opts.low_latency) SetConfigFlags(FLAG_VSYNC_HINT);
+
     size_t factor = 80;
     InitWindow(16*factor, 9*factor, "Map quiz");
     SetExitKey(KEY_Q);
 
-    int fileSize = 0;
-    unsigned char* fileData = LoadFileData("resources/Alegreya-Regular.ttf", &fileSize);
+    double font_start = GetTime();
+    int font_data_size = 0;
+    unsigned char *font_data = LoadFileData("resources/Alegreya-Regular.ttf", &font_data_size);
 
-    font.baseSize = FONT_SIZE_LOAD;
-    font.glyphCount = 95;
-    font.glyphs = LoadFontData(fileData, fileSize, FONT_SIZE_LOAD, 0, 95, FONT_SDF);
-    Image atlas = GenImageFontAtlas(font.glyphs, &font.recs, 95, FONT_SIZE_LOAD, 4, 0);
+    Image atlas = {0};
+    font = load_sdf_font(font_data, font_data_size, &atlas);
     font.texture = LoadTextureFromImage(atlas);
     UnloadImage(atlas);
+    printf("Font is ready in %.3lf s\n", GetTime() - font_start);
 
-    UnloadFileData(fileData);
-    
     shader = LoadShader(0, TextFormat("resources/shaders/glsl%i/sdf.fs", GLSL_VERSION));
+
+    map_shader.shader = LoadShader(0, TextFormat("resources/shaders/glsl%i/map.fs", GLSL_VERSION));
+    map_shader.labels_loc = GetShaderLocation(map_shader.shader, "labels");
+    map_shader.palette_loc = GetShaderLocation(map_shader.shader, "palette");
+    map_shader.province_count_loc = GetShaderLocation(map_shader.shader, "province_count");
+    map_shader.hovered_loc = GetShaderLocation(map_shader.shader, "hovered");
+    map_shader.highlight_loc = GetShaderLocation(map_shader.shader, "highlight");
+
+    mesh_shader.shader = LoadShader(TextFormat("resources/shaders/glsl%i/mesh.vs", GLSL_VERSION),
+                                    TextFormat("resources/shaders/glsl%i/mesh.fs", GLSL_VERSION));
+    mesh_shader.province_count_loc = GetShaderLocation(mesh_shader.shader, "province_count");
+    mesh_shader.hovered_loc = GetShaderLocation(mesh_shader.shader, "hovered");
+    mesh_shader.highlight_loc = GetShaderLocation(mesh_shader.shader, "highlight");
+    mesh_shader.land_loc = GetShaderLocation(mesh_shader.shader, "land");
     SetTextureFilter(font.texture, TEXTURE_FILTER_BILINEAR);
+    glyph_atlas_init(&glyph_atlas, font, font_data, font_data_size);
 
-    canvas = LoadRenderTexture(16*factor, 9*factor);
-    SetTextureFilter(canvas.texture, TEXTURE_FILTER_POINT);
+    static Game game = {0};
+    game_init(&game, &COUNTRIES, MAP_MEXICO, opts.seed, opts.render_mode);
 
-    fill_provinces(active_map);
+#if defined(GPU_PICKING)
+    if (opts.gpu_picking && gpu_picker_init(&gpu_picker)) {
+        game.gpu_picking = true;
+        game_reload_map(&game);
 
-    for (int i = 0; i < hmlen(PROVINCES); ++i) {
-        Province *p = &PROVINCES[i];
-        Color c = GetColor(p->key);
-        printf("#%08lx :: Color=(%d,%d,%d,%d) => %s\n", p->key, c.r, c.g, c.b, c.a, p->value); 
+        for (size_t i = 0; i < COUNTRIES.count; ++i) {
+            country_free_labels(&COUNTRIES.items[i]);
+        }
     }
+#else
+    if (opts.gpu_picking) fprintf(stderr, "WARNING: GPU picking needs desktop OpenGL 3.3, the clicks are resolved on the CPU\n");
+#endif
 
-    map_texture = LoadTextureFromImage(COUNTRIES.items[active_map].bw_map);
-    SetTextureFilter(map_texture, TEXTURE_FILTER_BILINEAR);
+    Province *provinces = COUNTRIES.items[game.session.active_map].provinces;
+    for (int i = 0; i < hmlen(provinces); ++i) {
+        Province *p = &provinces[i];
+        Color c = GetColor(p->key);
+        printf("#%08lx :: Color=(%d,%d,%d,%d) => %s\n", p->key, c.r, c.g, c.b, c.a, p->value);
+    }
 
-    hidden_province = select_random_province();
-    
 #if defined(PLATFORM_WEB)
-    emscripten_set_main_loop(update_draw_frame, 0, 1);
+    emscripten_set_main_loop_arg(update_draw_frame, &game, 0, 1);
 #else
-    SetTargetFPS(60);
-    
+    // the frame cap sleeps after the swap, so the input that comes meanwhile waits for the next poll;
+    // the swap blocking on vsync paces the frames without that
+    if (!opts.low_latency) SetTargetFPS(60);
+    game.idle = opts.idle;
+
     while (!WindowShouldClose()) {
-        update_draw_frame();
+        update_draw_frame(&game);
     }
-#endif 
 
-    UnloadFont(font);    
-    UnloadTexture(map_texture); 
-    UnloadRenderTexture(canvas);
+    click_latency_report(&game.latency);
+#endif
+
+    UnloadFont(font);
+    if (canvas.id > 0) UnloadRenderTexture(canvas);
     UnloadShader(shader);
+    UnloadShader(map_shader.shader);
+    UnloadShader(mesh_shader.shader);
+#if defined(GPU_PICKING)
+    if (game.gpu_picking) gpu_picker_free(&gpu_picker);
+#endif
+    game_free(&game);
+    text_cache_clear();
+    arrfree(text_batch);
+    glyph_atlas_free(&glyph_atlas);
 
     for (size_t i = 0; i < COUNTRIES.count; ++i) {
-        Country *c = &COUNTRIES.items[i];
-        UnloadImage(c->bw_map);
-        UnloadImage(c->color_map);
-        free(c->name);
-        free(c->display_name);
-        free(c->color_map_filename);
-        free(c->bw_map_filename);
+        unload_country(&COUNTRIES.items[i]);
     }
     free(COUNTRIES.items);
 
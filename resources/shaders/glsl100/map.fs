@@ -0,0 +1,36 @@
+#version 100
+
+precision mediump float;
+
+// The black-white map with the marked provinces colored and the province under the cursor highlighted
+
+varying vec2 fragTexCoord;
+varying vec4 fragColor;
+
+uniform sampler2D texture0;
+uniform vec4 colDiffuse;
+
+uniform sampler2D labels;    // province index + 1: low byte in luminance, high byte in alpha; 0 is no province
+uniform sampler2D palette;   // a texel per province, transparent if it is not marked
+uniform float province_count;
+uniform int hovered;         // province index + 1, 0 if none
+uniform vec4 highlight;      // alpha is the strength
+
+void main()
+{
+    vec4 color = texture2D(texture0, fragTexCoord);
+
+    vec4 label = texture2D(labels, fragTexCoord);
+    float id = floor(label.r * 255.0 + 0.5) + 256.0 * floor(label.a * 255.0 + 0.5);
+    if (id >= 32768.0) id = 0.0; // a border pixel only snapped to the nearest province
+
+    if (id > 0.0) {
+        vec4 mark = texture2D(palette, vec2((id - 0.5) / province_count, 0.5));
+        if (mark.a > 0.0) color = mark;
+    }
+
+    color *= colDiffuse * fragColor;
+    if ((hovered != 0) && (id == float(hovered))) color.rgb = mix(color.rgb, highlight.rgb, highlight.a);
+
+    gl_FragColor = color;
+}
@@ -0,0 +1,29 @@
+#version 100
+
+precision mediump float;
+
+// The provinces of the mesh with the marked ones colored and the one under the cursor highlighted
+
+varying float fragProvince;
+
+uniform sampler2D texture0;  // the palette: a texel per province, transparent if it is not marked
+uniform vec4 colDiffuse;
+
+uniform float province_count;
+uniform int hovered;         // province index + 1, 0 if none
+uniform vec4 highlight;      // alpha is the strength
+uniform vec4 land;           // of the provinces that are not marked
+
+void main()
+{
+    float id = floor(fragProvince + 0.5);
+    vec4 color = land;
+
+    vec4 mark = texture2D(texture0, vec2((id + 0.5) / province_count, 0.5));
+    if (mark.a > 0.0) color = mark;
+
+    color *= colDiffuse;
+    if (id + 1.0 == float(hovered)) color.rgb = mix(color.rgb, highlight.rgb, highlight.a);
+
+    gl_FragColor = color;
+}
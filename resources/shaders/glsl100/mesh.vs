@@ -0,0 +1,16 @@
+#version 100
+
+// The triangles of the provinces in the image coordinates, the province index is in the texture coordinate
+
+attribute vec3 vertexPosition;
+attribute vec2 vertexTexCoord;
+
+uniform mat4 mvp;
+
+varying float fragProvince; // the same at all the vertices of a triangle
+
+void main()
+{
+    fragProvince = vertexTexCoord.x;
+    gl_Position = mvp * vec4(vertexPosition, 1.0);
+}
@@ -0,0 +1,22 @@
+#version 100
+
+#extension GL_OES_standard_derivatives : enable
+
+precision mediump float;
+
+// The glyphs of the SDF font: the distance field is in alpha, 0.5 is the outline
+
+varying vec2 fragTexCoord;
+varying vec4 fragColor;
+
+uniform sampler2D texture0;
+uniform vec4 colDiffuse;
+
+void main()
+{
+    float d = texture2D(texture0, fragTexCoord).a - 0.5;
+    float aaf = length(vec2(dFdx(d), dFdy(d)));
+    float alpha = smoothstep(-aaf, aaf, d);
+
+    gl_FragColor = vec4(fragColor.rgb, fragColor.a * alpha) * colDiffuse;
+}
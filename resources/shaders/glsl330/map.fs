@@ -0,0 +1,36 @@
+#version 330
+
+// The black-white map with the marked provinces colored and the province under the cursor highlighted
+
+in vec2 fragTexCoord;
+in vec4 fragColor;
+
+uniform sampler2D texture0;
+uniform vec4 colDiffuse;
+
+uniform sampler2D labels;    // province index + 1: low byte in r, high byte in a; 0 is no province
+uniform sampler2D palette;   // a texel per province, transparent if it is not marked
+uniform float province_count;
+uniform int hovered;         // province index + 1, 0 if none
+uniform vec4 highlight;      // alpha is the strength
+
+out vec4 finalColor;
+
+void main()
+{
+    vec4 color = texture(texture0, fragTexCoord);
+
+    vec4 label = texture(labels, fragTexCoord);
+    int id = int(label.r * 255.0 + 0.5) + 256 * int(label.a * 255.0 + 0.5);
+    if (id >= 32768) id = 0; // a border pixel only snapped to the nearest province
+
+    if (id > 0) {
+        vec4 mark = texture(palette, vec2((float(id) - 0.5) / province_count, 0.5));
+        if (mark.a > 0.0) color = mark;
+    }
+
+    color *= colDiffuse * fragColor;
+    if ((hovered != 0) && (id == hovered)) color.rgb = mix(color.rgb, highlight.rgb, highlight.a);
+
+    finalColor = color;
+}
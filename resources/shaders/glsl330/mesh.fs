@@ -0,0 +1,28 @@
+#version 330
+
+// The provinces of the mesh with the marked ones colored and the one under the cursor highlighted
+
+flat in int fragProvince;
+
+uniform sampler2D texture0;  // the palette: a texel per province, transparent if it is not marked
+uniform vec4 colDiffuse;
+
+uniform float province_count;
+uniform int hovered;         // province index + 1, 0 if none
+uniform vec4 highlight;      // alpha is the strength
+uniform vec4 land;           // of the provinces that are not marked
+
+out vec4 finalColor;
+
+void main()
+{
+    vec4 color = land;
+
+    vec4 mark = texture(texture0, vec2((float(fragProvince) + 0.5) / province_count, 0.5));
+    if (mark.a > 0.0) color = mark;
+
+    color *= colDiffuse;
+    if (fragProvince + 1 == hovered) color.rgb = mix(color.rgb, highlight.rgb, highlight.a);
+
+    finalColor = color;
+}
@@ -0,0 +1,16 @@
+#version 330
+
+// The triangles of the provinces in the image coordinates, the province index is in the texture coordinate
+
+in vec3 vertexPosition;
+in vec2 vertexTexCoord;
+
+uniform mat4 mvp;
+
+flat out int fragProvince;
+
+void main()
+{
+    fragProvince = int(vertexTexCoord.x + 0.5);
+    gl_Position = mvp * vec4(vertexPosition, 1.0);
+}
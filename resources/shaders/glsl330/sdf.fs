@@ -1,14 +1,20 @@
-#version 330 core
+#version 330
 
-uniform sampler2D image; 
+// The glyphs of the SDF font: the distance field is in alpha, 0.5 is the outline
 
-in vec4 out_color;
-in vec2 out_uv;
+in vec2 fragTexCoord;
+in vec4 fragColor;
+
+uniform sampler2D texture0;
+uniform vec4 colDiffuse;
+
+out vec4 finalColor;
 
 void main()
 {
-    float d = texture(image, out_uv).r;
-    float aaf = fwidth(d);
-    float alpha = smoothstep(0.5 - aaf, 0.5 + aaf, d);
-    gl_FragColor = vec4(out_color.rgb, alpha);
+    float d = texture(texture0, fragTexCoord).a - 0.5;
+    float aaf = length(vec2(dFdx(d), dFdy(d)));
+    float alpha = smoothstep(-aaf, aaf, d);
+
+    finalColor = vec4(fragColor.rgb, fragColor.a * alpha) * colDiffuse;
 }